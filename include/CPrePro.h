@@ -0,0 +1,797 @@
+#ifndef CPrePro_H
+#define CPrePro_H
+
+#include <chrono>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <iostream>
+#include <fstream>
+
+class CPrePro {
+ public:
+  typedef std::vector<std::string> VariableList;
+
+  // error or warning message with location
+  struct Diagnostic {
+    bool        error { true };
+    std::string file;
+    int         line  { 0 };
+    std::string message;
+  };
+
+  typedef std::vector<Diagnostic> Diagnostics;
+
+ public:
+  CPrePro();
+ ~CPrePro();
+
+  void initialize();
+  void terminate();
+
+  // library use : configure (defines, include dirs, prelude files), save the
+  // state as the baseline and then process buffers (each starting from baseline)
+  void save_baseline();
+  void restore_baseline();
+
+  void clear_file_caches();
+  void check_file_caches();
+
+  bool process_buffer(const std::string &name, const std::string &buffer, std::string &result);
+
+  // macro state snapshot (defines, include guards and include tree) written after
+  // processing a prefix header and loaded at startup instead of reprocessing it
+  bool save_state(const std::string &fileName);
+  bool load_state(const std::string &fileName);
+
+  const Diagnostics &diagnostics() const { return diagnostics_; }
+
+  void set_capture_diagnostics(bool b) { capture_diagnostics_ = b; }
+
+  void add_define(const std::string &name, const VariableList &variables, const std::string &value,
+                  bool function=false);
+
+  void add_include_dir(const std::string &dir, bool std=false);
+
+  // command line use (see CPreProMain.cpp)
+  void process_args(int argc, char **argv);
+  void process_files();
+
+ private:
+  friend class CPreProExpr;
+  friend class CPreProPhaseTimer;
+
+  enum class TokenType {
+    NONE,
+    SPACE,
+    IDENTIFIER,
+    NUMBER,
+    STRING,
+    CHAR,
+    PUNCT,
+    OTHER
+  };
+
+  struct Atom;
+
+  // preprocessing token (text points into the current line, a define value
+  // or the line's text buffer so is only valid while the line is processed).
+  // The hide set is the set of defines which must not be replaced when the
+  // token is (re)scanned. Identifiers are interned as atoms.
+  struct Token {
+    TokenType        type     { TokenType::NONE };
+    std::string_view str;
+    int              hide_set { 0 };
+    Atom*            atom     { nullptr };
+
+    Token() { }
+
+    Token(TokenType type_, const char *str_, int len_) :
+     type(type_), str(str_, len_) {
+    }
+
+    bool isSpace() const { return type == TokenType::SPACE; }
+
+    bool isPunct(const char *s) const { return type == TokenType::PUNCT && str == s; }
+  };
+
+  // file contents (memory mapped or, for stdin, read into a growable buffer)
+  class FileData {
+   public:
+    FileData() { }
+   ~FileData();
+
+    bool open(const std::string &fileName);
+
+    bool isCurrent(const std::string &fileName) const;
+
+    const char *data() const { return data_; }
+    size_t      size() const { return size_; }
+
+   private:
+    FileData(const FileData &) = delete;
+    FileData &operator=(const FileData &) = delete;
+
+   private:
+    const char*       data_      { nullptr };
+    size_t            size_      { 0 };
+    bool              mapped_    { false };
+    std::vector<char> buffer_;
+    uint64_t          dev_       { 0 };
+    uint64_t          ino_       { 0 };
+    int64_t           mtime_     { 0 }; // nanoseconds
+    int64_t           open_time_ { 0 }; // nanoseconds
+  };
+
+  // block allocated storage for token text created during expansion
+  // (stringized arguments, pasted tokens). Cleared for each line.
+  class TextBuffer {
+   public:
+    TextBuffer() { }
+
+    void clear() { block_ = 0; pos_ = 0; }
+
+    const char *add(const char *str, int len);
+
+   private:
+    typedef std::vector<std::vector<char>> Blocks;
+
+    Blocks blocks_;
+    uint   block_ { 0 };
+    uint   pos_   { 0 };
+  };
+
+  // output sink : text is appended to a large buffer which is written to a file
+  // descriptor with write(2) when full (optionally by a background thread so
+  // processing continues while the previous buffer is written), or is appended
+  // directly to a caller's string
+  class OutputBuffer {
+   public:
+    OutputBuffer();
+   ~OutputBuffer();
+
+    int fd() const { return fd_; }
+    void setFd(int fd);
+
+    std::string *string() const { return str_; }
+    void setString(std::string *str);
+
+    void setBackground(bool b);
+
+    void write(const char *str, size_t len) {
+      if      (str_)
+        str_->append(str, len);
+      else if (pos_ + len <= buffer_.size()) {
+        memcpy(&buffer_[pos_], str, len);
+
+        pos_ += len;
+      }
+      else
+        writeLarge(str, len);
+    }
+
+    void put(char c) { write(&c, 1); }
+
+    void flush();
+
+   private:
+    OutputBuffer(const OutputBuffer &) = delete;
+    OutputBuffer &operator=(const OutputBuffer &) = delete;
+
+    void writeLarge(const char *str, size_t len);
+    void flushBuffer();
+    void writeData(const char *data, size_t len);
+    void writeThread();
+
+   private:
+    typedef std::vector<char> Buffer;
+
+    static const size_t buffer_size = 1 << 20;
+
+    int                     fd_           { 1 };
+    std::string*            str_          { nullptr };
+    Buffer                  buffer_;
+    size_t                  pos_          { 0 };
+    bool                    background_   { false };
+    std::thread             thread_;
+    std::mutex              mutex_;
+    std::condition_variable cond_;
+    Buffer                  write_buffer_;
+    size_t                  write_size_   { 0 };
+    bool                    pending_      { false };
+    bool                    done_         { false };
+    bool                    failed_       { false };
+  };
+
+  // objects allocated in blocks with a free list for reuse. Objects still in use
+  // are destroyed when the pool is destroyed (trivially destructible objects are
+  // not visited) and the blocks are freed in bulk.
+  template<typename T>
+  class ObjectPool {
+   public:
+    ObjectPool() { }
+
+   ~ObjectPool() {
+      if (! std::is_trivially_destructible<T>::value) {
+        for (auto &block : blocks_)
+          for (uint i = 0; i < block_size; ++i)
+            if (block[i].live)
+              reinterpret_cast<T *>(&block[i].data)->~T();
+      }
+    }
+
+    template<typename... Args>
+    T *create(Args&&... args) {
+      Slot *slot;
+
+      if (! free_.empty()) {
+        slot = free_.back();
+
+        free_.pop_back();
+
+        ++num_reused_;
+      }
+      else {
+        if (blocks_.empty() || pos_ >= block_size) {
+          blocks_.push_back(std::unique_ptr<Slot[]>(new Slot[block_size]));
+
+          pos_ = 0;
+        }
+
+        slot = &blocks_.back()[pos_++];
+      }
+
+      ++num_created_;
+
+      T *t = new (&slot->data) T(std::forward<Args>(args)...);
+
+      slot->live = true;
+
+      return t;
+    }
+
+    void destroy(T *t) {
+      t->~T();
+
+      // data is first member of slot
+      Slot *slot = reinterpret_cast<Slot *>(t);
+
+      slot->live = false;
+
+      free_.push_back(slot);
+    }
+
+    long numCreated() const { return num_created_; }
+    long numReused () const { return num_reused_; }
+    long numBlocks () const { return long(blocks_.size()); }
+
+   private:
+    ObjectPool(const ObjectPool &) = delete;
+    ObjectPool &operator=(const ObjectPool &) = delete;
+
+   private:
+    struct Slot {
+      typename std::aligned_storage<sizeof(T), alignof(T)>::type data;
+      bool                                                        live { false };
+    };
+
+    static const uint block_size = 256;
+
+    typedef std::vector<std::unique_ptr<Slot[]>> Blocks;
+    typedef std::vector<Slot *>                  FreeSlots;
+
+    Blocks    blocks_;
+    uint      pos_         { 0 };
+    FreeSlots free_;
+    long      num_created_ { 0 };
+    long      num_reused_  { 0 };
+  };
+
+  struct Context {
+    bool active     { false };
+    bool processed  { false };
+    bool processing { false };
+  };
+
+  typedef std::vector<Token> Tokens;
+
+  enum class DefineOpType {
+    TOKENS,     // replacement tokens
+    ARG,        // argument (unexpanded)
+    EXPAND_ARG, // fully expanded argument
+    STRINGIZE   // stringized argument
+  };
+
+  // compiled replacement list operation. Paste means the first token is pasted
+  // to the last token of the previous operation (if it added any tokens).
+  struct DefineOp {
+    DefineOpType type  { DefineOpType::TOKENS };
+    int          start { 0 };     // token range for TOKENS
+    int          end   { 0 };
+    int          arg   { -1 };    // variable index for ARG, EXPAND_ARG and STRINGIZE
+    bool         paste { false };
+
+    DefineOp(DefineOpType type_, int start_, int end_, int arg_, bool paste_) :
+     type(type_), start(start_), end(end_), arg(arg_), paste(paste_) {
+    }
+  };
+
+  typedef std::vector<DefineOp> DefineOps;
+
+  typedef std::vector<Atom *> Atoms;
+  typedef std::vector<int>    ArgCounts;
+
+  struct Define {
+    Atom*        atom     { nullptr }; // name
+    bool         function { false };
+    bool         baseline { false }; // shared with baseline (not modified or deleted)
+    VariableList variables;
+    Atoms        variable_atoms;
+    std::string  value;
+    Tokens       value_tokens; // replacement list (parsed from value)
+    DefineOps    value_ops;    // replacement list compiled into operations
+    ArgCounts    expand_counts; // number of EXPAND_ARG operations for each argument
+
+    Define(Atom *atom_, bool function_, const VariableList &variables_,
+           const std::string &value_) :
+     atom(atom_), function(function_), variables(variables_), value(value_) {
+    }
+
+    const std::string &name() const;
+  };
+
+  // interned identifier with its current define (if any). Identifiers are
+  // compared and defines are looked up by atom pointer.
+  struct Atom {
+    std::string name;
+    uint        hash   { 0 };
+    Define*     define { nullptr };
+
+    Atom(const char *name_, int len_, uint hash_) :
+     name(name_, len_), hash(hash_) {
+    }
+  };
+
+  // open addressing (linear probe) hash table of atoms keyed on name hash. Atoms
+  // are only removed by truncating to an earlier size (see restore_baseline).
+  class AtomTable {
+   public:
+    AtomTable();
+
+    int size() const { return int(atoms_.size()); }
+
+    void getDefines(std::vector<Define *> &defines) const;
+    void clearDefines();
+
+    Atom *find(const char *name, int len, uint hash) const;
+
+    // existing atom or shared empty atom (never defined) if none
+    Atom *lookup(const char *name, int len, uint hash);
+
+    Atom *intern(const char *name, int len, uint hash);
+
+    // remove atoms added after first size atoms
+    void truncate(int size);
+
+   private:
+    AtomTable(const AtomTable &) = delete;
+    AtomTable &operator=(const AtomTable &) = delete;
+
+    void rehash(uint num_slots);
+
+   private:
+    struct Slot {
+      uint  hash { 0 };
+      Atom* atom { nullptr };
+    };
+
+    typedef std::vector<Slot> Slots;
+
+    Slots            slots_;
+    uint             mask_  { 0 };
+    Atoms            atoms_; // in creation order
+    Atom             none_  { "", 0, 0 };
+    ObjectPool<Atom> pool_;
+  };
+
+  struct Include;
+
+  using Includes = std::vector<Include *>;
+
+  struct Include {
+    Include(const std::string &filename_) :
+     filename(filename_) {
+    }
+
+    void print(std::ostream &os, int depth=0) {
+      for (int i = 0; i < depth; ++i)
+        os << " ";
+
+      os << filename << "\n";
+
+      for (const auto &i : includes)
+        i->print(os, depth + 1);
+    }
+
+    std::string filename;
+    Includes    includes;
+  };
+
+  // include guard (#ifndef X ... #endif wrapping whole file) or #pragma once for
+  // a processed file
+  struct FileGuard {
+    std::string guard;
+    bool        once { false };
+  };
+
+  enum class GuardState {
+    START,    // no significant lines yet
+    IN_GUARD, // inside #ifndef <guard>
+    END,      // after matching #endif
+    NONE      // file has no include guard
+  };
+
+  // include guard detection state for file being processed
+  struct GuardDetect {
+    GuardState  state { GuardState::START };
+    std::string guard;
+    int         depth { 0 };
+  };
+
+  // resolved include file
+  struct IncludeFile {
+    std::string file;
+    std::string key;          // file guard key (see file_key)
+    bool        std { false };
+  };
+
+  // profiled processing phases (see -stats)
+  enum class Phase {
+    READ,       // read (map) file
+    SCAN,       // split lines and skip inactive lines
+    TRIGRAPHS,  // replace trigraphs
+    COMMENTS,   // remove comments
+    TOKENIZE,   // split line into tokens
+    COMMANDS,   // directive dispatch
+    EXPAND,     // define expansion
+    EXPRESSION, // #if/#elif evaluation
+    INCLUDE,    // include file resolution
+    OUTPUT,     // write output
+    NUM_PHASES
+  };
+
+  struct PhaseStats {
+    long count { 0 };
+    long time  { 0 }; // nanoseconds (exclusive of nested phases)
+  };
+
+  struct Stats {
+    long       include_cache_hits   { 0 };
+    long       include_cache_misses { 0 };
+    long       dir_cache_reads      { 0 };
+    long       dir_cache_hits       { 0 };
+    long       dir_cache_misses     { 0 };
+    long       includes_skipped     { 0 };
+    long       lines_skipped        { 0 };
+    long       files_read           { 0 };
+    long       defines_added        { 0 };
+    long       defines_expanded     { 0 };
+    long       max_expand_depth     { 0 };
+    long       bytes_in             { 0 };
+    long       bytes_out            { 0 };
+    long       objects_allocated    { 0 };
+    long       objects_reused       { 0 };
+    long       pool_blocks          { 0 };
+    long       result_cache_hits    { 0 };
+    long       result_cache_misses  { 0 };
+    long       result_cache_evicted { 0 };
+    PhaseStats phases[int(Phase::NUM_PHASES)];
+
+    Stats &operator+=(const Stats &stats);
+  };
+
+  // file read while producing a cached result. Validated by size and modification
+  // time with content hash fallback.
+  struct CacheFile {
+    std::string name;
+    uint64_t    size  { 0 };
+    int64_t     mtime { 0 }; // nanoseconds
+    uint64_t    hash  { 0 };
+  };
+
+  typedef std::vector<CacheFile> CacheFiles;
+
+  // include file lookup (#include or __has_include) made while producing a cached
+  // result. Valid if the name still resolves to the same file (or to none).
+  struct CacheLookup {
+    std::string name;
+    std::string dir;  // directory searched first (quoted include)
+    std::string file; // resolved file ("" if not found)
+  };
+
+  typedef std::vector<CacheLookup> CacheLookups;
+
+  // macro argument as token range of the input
+  struct ArgSpan {
+    int start { 0 };
+    int end   { 0 };
+  };
+
+  typedef std::vector<Define *>      Defines;
+  typedef std::vector<Context *>     ContextStack;
+  typedef std::vector<std::string>   FileList;
+  typedef std::vector<std::string>   DirList;
+  typedef std::vector<Tokens>        ArgTokensList;
+  typedef std::vector<ArgSpan>       ArgSpans;
+
+  // scratch space for one level of define expansion (owned by the session and
+  // reused for each line so expansion does not allocate once buffers have grown)
+  struct ExpandScratch {
+    Tokens        stack;         // pushed back replacement tokens (reversed)
+    Tokens        arg_tokens;    // arguments of current define
+    ArgSpans      args;
+    Tokens        replacement;   // substituted replacement list
+    ArgTokensList expanded_args; // expanded arguments (for arguments used more than once)
+    ArgCounts     expanded;
+  };
+
+  typedef std::vector<std::unique_ptr<ExpandScratch>> ExpandScratchList;
+  typedef std::vector<Define *>      HideSet;
+  typedef std::vector<HideSet>       HideSets;
+  typedef std::unordered_map<std::string, FileGuard>     FileGuards;
+  typedef std::unordered_map<std::string, IncludeFile>   IncludeCache;
+  typedef std::unordered_set<std::string>                DirFiles;
+  typedef std::unordered_set<std::string>                DepsSet;
+  typedef std::unordered_map<std::string, DirFiles>      DirCache;
+  typedef std::shared_ptr<FileData>                      FileDataP;
+
+  // cached file contents with cache generation it was last checked in
+  struct FileDataEntry {
+    FileDataP file_data;
+    uint      generation { 0 };
+  };
+
+  // modification time of directory searched for include files (when checked)
+  struct DirStamp {
+    int64_t mtime { -1 }; // nanoseconds (-1 if missing)
+    int64_t time  { 0 };
+  };
+
+  typedef std::unordered_map<std::string, FileDataEntry> FileDataMap;
+  typedef std::unordered_map<std::string, DirStamp>      DirStamps;
+
+  // read only caches shared by parallel workers. The generation is incremented by
+  // check_file_caches so cached files are checked again when next used.
+  struct SharedCache {
+    std::mutex   mutex;
+    IncludeCache include_cache;
+    DirCache     dir_files;
+    DirStamps    dir_stamps;
+    FileDataMap  file_data;
+    size_t       file_data_size { 0 };
+    uint         generation     { 0 };
+  };
+
+  typedef std::shared_ptr<SharedCache> SharedCacheP;
+
+  typedef std::chrono::steady_clock Clock;
+  typedef Clock::time_point         TimePoint;
+  typedef std::vector<Phase>        PhaseStack;
+
+ private:
+  void error  (const std::string &msg);
+  void warning(const std::string &msg);
+  void diagnostic(bool error, const std::string &msg);
+
+  void process_option(const std::string &option, int &argc, char **argv);
+
+  void add_define_option(const std::string &define);
+  void add_include_option(const std::string &define);
+
+  void init_worker(const CPrePro &prepro);
+
+  void process_arg(const std::string &arg);
+  void process_files_parallel();
+  Include *copy_include(const Include *include);
+  void process_input_file(const std::string &file);
+  void process_file(const std::string &file, const std::string &key="");
+  void process_data(const char *data, size_t size);
+  void process_stream(int fd);
+  void process_lines(const char *data, size_t size);
+  FileDataP get_file_data(const std::string &file);
+  void skip_lines(const char *&p, const char *p_end);
+  void process_line(std::string_view line);
+  void detect_guard(const std::string &command, const Tokens &data);
+  void process_command(const std::string &command, const Tokens &data);
+  void process_if_command(const Tokens &data);
+  void process_ifdef_command(const Tokens &data);
+  void process_ifndef_command(const Tokens &data);
+  void process_else_command(const Tokens &data);
+  void process_elif_command(const Tokens &data);
+  void process_endif_command(const Tokens &data);
+  void process_define_command(const Tokens &data);
+  void process_undef_command(const Tokens &data);
+  void process_include_command(const Tokens &data);
+  void process_error_command(const Tokens &data);
+  void process_warning_command(const Tokens &data);
+  void process_pragma_command(const Tokens &data);
+  void process_line_command(const Tokens &data);
+  int  process_expression(const Tokens &expression);
+
+  void output_line(std::string_view line);
+  void output_tokens(const Tokens &tokens);
+  void sync_line_marker();
+  void output_line_marker(int line, int flag=0);
+
+  void replace_trigraphs(std::string &line);
+  void remove_comments(std::string_view line, bool preprocessor_line, std::string &line1);
+
+  static void tokenize(const char *str, int len, Tokens &tokens);
+  static std::string tokens_to_string(const Tokens &tokens);
+
+  void replace_defines(const Tokens &tokens, bool preprocessor_line, Tokens &result);
+  void expand_tokens(const Token *tokens, int num_tokens, bool preprocessor_line,
+                     Tokens &result);
+  void substitute_define(Define *define, const Token *input, const ArgSpans &args,
+                         int hide_set, bool preprocessor_line, Tokens &result);
+  void stringize_arg(const Token *arg, int len, Tokens &result);
+  void paste_token(Tokens &tokens, int start, const Token &token);
+
+  bool hide_set_contains(int hide_set, Define *define) const;
+  int  hide_set_add(int hide_set, Define *define);
+  int  hide_set_union(int hide_set1, int hide_set2);
+  int  hide_set_intersect(int hide_set1, int hide_set2);
+  int  add_hide_set(const HideSet &hide_set);
+  void clear_hide_sets();
+
+  ExpandScratch &expand_scratch(int depth);
+  void           trim_expand_scratch();
+
+  void add_file(const std::string &file);
+
+  void compile_define(Define *define);
+  void remove_define(const std::string &name);
+  bool        is_defined(const Token &token);
+  Define     *get_define(const std::string &name);
+  Define     *get_define(const char *name, int len);
+  Define     *get_define(const Token &token);
+
+  Atom *intern(const char *name, int len);
+  void  intern_tokens(Tokens &tokens, int start=0);
+  Atom *lookup(const char *name, int len);
+  void  lookup_tokens(Tokens &tokens, int start=0);
+
+  static uint hashName(const char *name, int len);
+
+  IncludeFile get_include_file(const std::string &file, bool quoted);
+  std::string find_include_file(const std::string &file, const std::string &current_dir,
+                                bool &std);
+  bool        include_file_exists(const std::string &file);
+  void        add_dir_stamp(const std::string &dir);
+  std::string file_key(const std::string &file) const;
+  void        destroy_include(Include *include);
+
+  uint64_t cache_key(const std::string &file, const FileData &file_data);
+  bool     read_cache(const std::string &cacheFile);
+  bool     write_cache(const std::string &cacheFile, const std::string &output);
+  void     evict_cache();
+  void     add_cache_file(const std::string &file, const FileData &file_data);
+  void     add_cache_lookup(const std::string &name, const std::string &dir,
+                            const std::string &file);
+
+  static uint64_t hashData(const char *data, size_t len, uint64_t hash=0);
+
+  bool is_deps() const { return deps_only_ || deps_file_; }
+
+  void add_dependency(const std::string &file, bool std);
+  void add_dependency_rule(const std::string &file);
+  void write_dependencies();
+
+  bool is_stats() const { return stats_; }
+
+  void start_phase(Phase phase);
+  void end_phase();
+
+  Stats get_stats() const;
+
+  void print_stats(std::ostream &os) const;
+  void print_stats_json(std::ostream &os) const;
+
+  void start_context(bool processing);
+  bool end_context();
+
+ private:
+  FileList      files_;
+  AtomTable     atoms_;
+  DirList       include_dirs_;
+  DirList       std_include_dirs_;
+  Context*      context_         { nullptr };
+  ContextStack  context_stack_;
+  bool          no_blank_lines_  { false };
+  bool          echo_input_      { false };
+  bool          no_std_          { false };
+  bool          quiet_           { false };
+  bool          warn_            { true };
+  bool          debug_           { false };
+  bool          list_includes_   { false };
+  bool          dir_cache_       { false };
+  bool          stats_           { false };
+  bool          stats_json_      { false };
+  bool          deps_only_       { false }; // -M/-MM : dependencies instead of output
+  bool          deps_file_       { false }; // -MD/-MMD : dependencies file with output
+  bool          deps_no_std_     { false }; // -MM/-MMD : skip system headers
+  bool          deps_phony_      { false }; // -MP : phony target for each header
+  std::string   deps_output_file_;          // -MF
+  FileList      deps_targets_;              // -MT
+  FileList      deps_files_;
+  DepsSet       deps_set_;
+  std::string   deps_rules_;
+  std::string   cache_dir_;                 // -cache_dir : result cache directory
+  long          cache_size_      { 256L*1024*1024 }; // -cache_size (MB) : eviction limit
+  bool          cache_record_    { false };
+  CacheFiles    cache_files_;
+  DepsSet       cache_file_set_;
+  CacheLookups  cache_lookups_;
+  DepsSet       cache_lookup_set_;
+  int           num_diagnostics_ { 0 };
+  std::string   save_state_file_;
+  int           num_jobs_        { 1 };
+  std::string   current_file_    { "None" }; // file name for diagnostics (set by #line)
+  int           current_line_    { 0 };
+  std::string   current_path_;              // path of file being processed
+  std::string   current_key_;               // file guard key of file being processed
+  bool          current_std_     { false };
+  int           file_depth_      { 0 };
+  int           line_start_      { 0 };       // first line of current (continued) line
+  int           skip_depth_      { 0 };       // nested conditional depth in skip_lines
+  bool          line_markers_    { false };
+  std::string   marker_file_;
+  int           marker_line_     { 0 };       // source line of next output line
+  bool          in_comment_      { false };
+  ObjectPool<Define>  define_pool_;
+  ObjectPool<Context> context_pool_;
+  ObjectPool<Include> include_pool_;
+  Include*      current_include_ { nullptr };
+  FileGuards    file_guards_;
+  GuardDetect*  guard_detect_    { nullptr };
+  SharedCacheP  shared_;
+  Defines       baseline_defines_;
+  FileGuards    baseline_file_guards_;
+  size_t        baseline_num_includes_ { 0 };
+  int           baseline_num_atoms_ { 0 };
+  bool          has_baseline_    { false };
+  Diagnostics   diagnostics_;
+  bool          capture_diagnostics_ { false };
+  Stats         stats_data_;
+  PhaseStack    phase_stack_;
+  TimePoint     phase_start_;
+  TimePoint     start_time_;
+  std::string   output_file_;
+  OutputBuffer  output_;
+  std::string   comment_line_;
+  Tokens        line_tokens_;
+  Tokens        data_tokens_;
+  Tokens        expand_tokens_;
+  Tokens        paste_tokens_;
+  TextBuffer    text_buffer_;
+  HideSets      hide_sets_;
+  int           num_hide_sets_   { 1 };
+  HideSet       hide_set_scratch_;
+  ExpandScratchList expand_scratch_;
+  int           expand_depth_    { 0 };
+  std::string   stringize_str_;
+};
+
+#endif
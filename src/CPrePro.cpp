@@ -1,1395 +1,5025 @@
 #include <CPrePro.h>
-#include <CExpr.h>
+#include <CPreProExpr.h>
+#include <CPreProScan.h>
 #include <CFile.h>
 #include <CStrUtil.h>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <cerrno>
 #include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <functional>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define CPP_SUPPORT 1
 
 #define XSTR(s) STR(s)
 #define STR(s) #s
 
-class DefinedFunction : public CExprFunctionObj {
+// modification times closer than this to the time they were checked are not
+// trusted (a later change may have the same time on file systems with coarse
+// timestamps)
+static const int64_t racy_time = 1000000000;
+
+// file modification time in nanoseconds
+static int64_t statMTime(const struct stat &st)
+{
+  return int64_t(st.st_mtim.tv_sec)*1000000000 + st.st_mtim.tv_nsec;
+}
+
+// current (real) time in nanoseconds (for comparison with file times)
+static int64_t currentTime()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  return int64_t(ts.tv_sec)*1000000000 + ts.tv_nsec;
+}
+
+// time phase while in scope (when stats are enabled)
+class CPreProPhaseTimer {
  public:
-  DefinedFunction(CPrePro *prepro) :
-   prepro_(prepro) {
+  CPreProPhaseTimer(CPrePro *prepro, CPrePro::Phase phase) :
+   prepro_(prepro->is_stats() ? prepro : nullptr) {
+    if (prepro_)
+      prepro_->start_phase(phase);
+  }
+
+ ~CPreProPhaseTimer() {
+    if (prepro_)
+      prepro_->end_phase();
+  }
+
+ private:
+  CPrePro *prepro_ { nullptr };
+};
+
+CPrePro::
+CPrePro()
+{
+  start_time_ = Clock::now();
+
+  shared_ = std::make_shared<SharedCache>();
+
+  context_stack_.clear();
+
+  clear_hide_sets();
+
+#ifdef CPRE_PRO_STD_DIRS
+  std::string paths_str = XSTR(CPRE_PRO_STD_DIRS);
+
+  std::vector<std::string> paths;
+
+  CStrUtil::addWords(paths_str, paths);
+
+  for (auto &path : paths)
+    add_include_dir(path, true);
+#endif
+}
+
+CPrePro::
+~CPrePro()
+{
+}
+
+void
+CPrePro::
+initialize()
+{
+  start_context(true);
+}
+
+// save current defines and include guards as the baseline state for process_buffer
+void
+CPrePro::
+save_baseline()
+{
+  for (const auto &define : baseline_defines_)
+    define->baseline = false;
+
+  baseline_defines_.clear();
+
+  atoms_.getDefines(baseline_defines_);
+
+  for (const auto &define : baseline_defines_)
+    define->baseline = true;
+
+  baseline_file_guards_ = file_guards_;
+
+  baseline_num_includes_ = (current_include_ ? current_include_->includes.size() : 0);
+
+  baseline_num_atoms_ = atoms_.size();
+
+  has_baseline_ = true;
+}
+
+// clear cached include file resolution, directory listings and file contents so
+// files added, removed, renamed or changed since they were cached are found again
+void
+CPrePro::
+clear_file_caches()
+{
+  std::unique_lock<std::mutex> lock(shared_->mutex);
+
+  shared_->include_cache.clear();
+  shared_->dir_files    .clear();
+  shared_->dir_stamps   .clear();
+  shared_->file_data    .clear();
+
+  shared_->file_data_size = 0;
+}
+
+// check file caches are still valid. If a directory searched for include files
+// has changed (file added, removed or renamed) the include file resolutions and
+// its listing are cleared. Cached file contents are checked (size, modification
+// time and inode) when next used.
+void
+CPrePro::
+check_file_caches()
+{
+  std::unique_lock<std::mutex> lock(shared_->mutex);
+
+  ++shared_->generation;
+
+  int64_t time = currentTime();
+
+  bool changed = false;
+
+  for (auto &pd : shared_->dir_stamps) {
+    DirStamp &stamp = pd.second;
+
+    struct stat st;
+
+    int64_t mtime = (stat(pd.first.c_str(), &st) == 0 ? statMTime(st) : -1);
+
+    if (mtime != stamp.mtime || stamp.mtime > stamp.time - racy_time) {
+      shared_->dir_files.erase(pd.first);
+
+      changed = true;
+    }
+
+    stamp.mtime = mtime;
+    stamp.time  = time;
+  }
+
+  if (changed)
+    shared_->include_cache.clear();
+}
+
+// restore defines, include guards, include tree and conditional state to baseline.
+// File caches are checked so files changed since the last buffer are read again
+void
+CPrePro::
+restore_baseline()
+{
+  std::vector<Define *> defines;
+
+  atoms_.getDefines(defines);
+
+  for (const auto &define : defines)
+    if (! define->baseline)
+      define_pool_.destroy(define);
+
+  atoms_.clearDefines();
+
+  if (has_baseline_) {
+    for (const auto &define : baseline_defines_)
+      define->atom->define = define;
+
+    file_guards_ = baseline_file_guards_;
+  }
+  else
+    file_guards_ = FileGuards();
+
+  // remove atoms added since baseline (buffer defines)
+  atoms_.truncate(has_baseline_ ? baseline_num_atoms_ : 0);
+
+  // remove includes added since baseline
+  if (current_include_) {
+    Includes &includes = current_include_->includes;
+
+    for (size_t i = baseline_num_includes_; i < includes.size(); ++i)
+      destroy_include(includes[i]);
+
+    includes.resize(std::min(includes.size(), baseline_num_includes_));
+  }
+
+  check_file_caches();
+
+  if (context_) {
+    while (! context_stack_.empty())
+      end_context();
+  }
+  else
+    start_context(true);
+
+  context_->active     = true;
+  context_->processing = true;
+  context_->processed  = true;
+
+  in_comment_ = false;
+}
+
+// process buffer (from baseline state) into result. Diagnostics are available from
+// diagnostics()
+bool
+CPrePro::
+process_buffer(const std::string &name, const std::string &buffer, std::string &result)
+{
+  restore_baseline();
+
+  diagnostics_.clear();
+
+  // output is added directly to result
+  output_.flush();
+
+  std::string *save_output_string = output_.string();
+
+  result.clear();
+
+  output_.setString(&result);
+
+  std::string save_current_file = current_file_;
+  std::string save_current_path = current_path_;
+  std::string save_current_key  = current_key_;
+  uint        save_current_line = current_line_;
+
+  current_file_ = name;
+  current_path_ = name;
+  current_key_  = name;
+  current_line_ = 0;
+
+  process_data(buffer.c_str(), buffer.size());
+
+  if (! context_stack_.empty())
+    error("Missing endif");
+
+  current_file_ = save_current_file;
+  current_path_ = save_current_path;
+  current_key_  = save_current_key;
+  current_line_ = save_current_line;
+
+  output_.setString(save_output_string);
+
+  for (const auto &diagnostic : diagnostics_)
+    if (diagnostic.error)
+      return false;
+
+  return true;
+}
+
+// state file : magic, version and byte order check followed by the atoms used by
+// the defines, the compiled defines, file guards and include tree. Strings are a
+// 32 bit length followed by the characters.
+static const char     state_magic[8] = { 'C', 'P', 'P', 'S', 'T', 'A', 'T', 'E' };
+static const uint32_t state_version  = 3;
+static const uint32_t state_order    = 0x01020304;
+
+// size (in elements) above which expansion scratch buffers are released after a line
+static const size_t max_scratch_size = 65536;
+
+// total size of file contents kept in the shared cache
+static const size_t max_file_data_cache_size = 256*1024*1024;
+
+// result cache file (see -cache_dir) : magic and version followed by the files read
+// (name, size, modification time and content hash), the include lookups (name,
+// directory and resolved file) and the output
+static const char     result_cache_magic[8] = { 'C', 'P', 'P', 'C', 'A', 'C', 'H', 'E' };
+static const uint64_t result_cache_version  = 2;
+
+bool
+CPrePro::
+save_state(const std::string &fileName)
+{
+  std::ofstream os(fileName, std::ofstream::out | std::ofstream::binary);
+
+  if (! os) {
+    error("Failed to write state file '" + fileName + "'");
+    return false;
+  }
+
+  auto writeInt = [&](uint32_t i) {
+    os.write(reinterpret_cast<const char *>(&i), sizeof(i));
+  };
+
+  auto writeString = [&](const std::string &str) {
+    writeInt(uint32_t(str.size()));
+
+    os.write(str.c_str(), str.size());
+  };
+
+  std::function<void (const Include *)> writeInclude = [&](const Include *include) {
+    writeString(include->filename);
+
+    writeInt(uint32_t(include->includes.size()));
+
+    for (const auto &include1 : include->includes)
+      writeInclude(include1);
+  };
+
+  os.write(state_magic, sizeof(state_magic));
+
+  writeInt(state_version);
+  writeInt(state_order);
+
+  //---
+
+  std::vector<Define *> defines;
+
+  atoms_.getDefines(defines);
+
+  // atoms used by the defines (referenced by index)
+  Atoms                                  atoms;
+  std::unordered_map<const Atom *, uint> atom_index;
+
+  auto addAtom = [&](Atom *atom) {
+    if (atom && atom_index.find(atom) == atom_index.end()) {
+      atom_index[atom] = uint(atoms.size());
+
+      atoms.push_back(atom);
+    }
+  };
+
+  auto writeAtom = [&](const Atom *atom) {
+    writeInt(atom ? atom_index[atom] + 1 : 0);
+  };
+
+  for (const auto &define : defines) {
+    addAtom(define->atom);
+
+    for (const auto &atom : define->variable_atoms)
+      addAtom(atom);
+
+    for (const auto &token : define->value_tokens)
+      addAtom(token.atom);
+  }
+
+  writeInt(uint32_t(atoms.size()));
+
+  for (const auto &atom : atoms)
+    writeString(atom->name);
+
+  //---
+
+  // defines are written compiled (tokens as offsets into the value and operations)
+  writeInt(uint32_t(defines.size()));
+
+  for (const auto &define : defines) {
+    writeAtom(define->atom);
+
+    writeInt(define->function);
+
+    writeInt(uint32_t(define->variables.size()));
+
+    for (const auto &variable : define->variables)
+      writeString(variable);
+
+    for (const auto &atom : define->variable_atoms)
+      writeAtom(atom);
+
+    writeString(define->value);
+
+    writeInt(uint32_t(define->value_tokens.size()));
+
+    for (const auto &token : define->value_tokens) {
+      writeInt(uint32_t(token.type));
+      writeInt(uint32_t(token.str.data() - define->value.c_str()));
+      writeInt(uint32_t(token.str.size()));
+
+      writeAtom(token.atom);
+    }
+
+    writeInt(uint32_t(define->value_ops.size()));
+
+    for (const auto &op : define->value_ops) {
+      writeInt(uint32_t(op.type));
+      writeInt(uint32_t(op.start));
+      writeInt(uint32_t(op.end));
+      writeInt(uint32_t(op.arg + 1));
+      writeInt(op.paste);
+    }
+
+    for (const auto &count : define->expand_counts)
+      writeInt(uint32_t(count));
+  }
+
+  //---
+
+  writeInt(uint32_t(file_guards_.size()));
+
+  for (const auto &pg : file_guards_) {
+    writeString(pg.first);
+    writeString(pg.second.guard);
+
+    writeInt(pg.second.once);
+  }
+
+  //---
+
+  writeInt(current_include_ ? 1 : 0);
+
+  if (current_include_)
+    writeInclude(current_include_);
+
+  if (! os) {
+    error("Failed to write state file '" + fileName + "'");
+    return false;
+  }
+
+  return true;
+}
+
+// load state file (memory mapped). Defines are added to the current defines.
+bool
+CPrePro::
+load_state(const std::string &fileName)
+{
+  FileData file_data;
+
+  if (! file_data.open(fileName)) {
+    error("Failed to read state file '" + fileName + "'");
+    return false;
+  }
+
+  const char *p     = file_data.data();
+  const char *p_end = p + file_data.size();
+
+  bool ok = true;
+
+  auto readInt = [&]() {
+    uint32_t i = 0;
+
+    if (p + sizeof(i) > p_end) {
+      ok = false;
+      return i;
+    }
+
+    memcpy(&i, p, sizeof(i));
+
+    p += sizeof(i);
+
+    return i;
+  };
+
+  auto readString = [&](std::string &str) {
+    uint32_t len = readInt();
+
+    if (! ok || len > uint32_t(p_end - p)) {
+      ok = false;
+      return;
+    }
+
+    str.assign(p, len);
+
+    p += len;
+  };
+
+  std::function<Include *()> readInclude = [&]() {
+    std::string filename;
+
+    readString(filename);
+
+    Include *include = include_pool_.create(filename);
+
+    uint32_t num_includes = readInt();
+
+    for (uint32_t i = 0; ok && i < num_includes; ++i)
+      include->includes.push_back(readInclude());
+
+    return include;
+  };
+
+  if (file_data.size() < sizeof(state_magic) ||
+      memcmp(p, state_magic, sizeof(state_magic)) != 0) {
+    error("Invalid state file '" + fileName + "'");
+    return false;
+  }
+
+  p += sizeof(state_magic);
+
+  if (readInt() != state_version || readInt() != state_order) {
+    error("Incompatible state file '" + fileName + "'");
+    return false;
+  }
+
+  //---
+
+  uint32_t num_atoms = readInt();
+
+  Atoms atoms;
+
+  std::string name;
+
+  for (uint32_t i = 0; ok && i < num_atoms; ++i) {
+    readString(name);
+
+    if (ok)
+      atoms.push_back(intern(name.c_str(), int(name.size())));
   }
 
-  CExprValuePtr operator()(CExpr *, const CExprValueArray &values) override {
-    return prepro_->defined_proc(&values[0], int(values.size()));
-  }
+  // atom index (0 for none)
+  auto readAtom = [&]() {
+    uint32_t i = readInt();
+
+    if (i > atoms.size()) {
+      ok = false;
+      return static_cast<Atom *>(nullptr);
+    }
+
+    return (i > 0 ? atoms[i - 1] : nullptr);
+  };
+
+  //---
+
+  // compiled define (tokens as offsets into the value)
+  struct TokenData {
+    TokenType type   { TokenType::NONE };
+    uint32_t  offset { 0 };
+    uint32_t  len    { 0 };
+    Atom*     atom   { nullptr };
+  };
+
+  typedef std::vector<TokenData> TokenDataList;
+
+  uint32_t num_defines = readInt();
+
+  std::string   value;
+  VariableList  variables;
+  Atoms         variable_atoms;
+  TokenDataList token_data;
+  DefineOps     ops;
+  ArgCounts     expand_counts;
+
+  for (uint32_t i = 0; ok && i < num_defines; ++i) {
+    Atom *atom = readAtom();
+
+    bool function = readInt();
+
+    uint32_t num_variables = readInt();
+
+    if (! ok || ! atom || num_variables > uint32_t(p_end - p)) {
+      ok = false;
+      break;
+    }
+
+    variables.resize(num_variables);
+
+    for (auto &variable : variables)
+      readString(variable);
+
+    variable_atoms.resize(num_variables);
+
+    for (auto &variable_atom : variable_atoms)
+      variable_atom = readAtom();
+
+    readString(value);
+
+    uint32_t num_tokens = readInt();
+
+    if (! ok || num_tokens > uint32_t(p_end - p)) {
+      ok = false;
+      break;
+    }
+
+    token_data.resize(num_tokens);
+
+    for (auto &token : token_data) {
+      uint32_t type = readInt();
+
+      token.type   = TokenType(type);
+      token.offset = readInt();
+      token.len    = readInt();
+      token.atom   = readAtom();
+
+      if (type > uint32_t(TokenType::OTHER) || token.offset > value.size() ||
+          token.len > value.size() - token.offset)
+        ok = false;
+    }
+
+    uint32_t num_ops = readInt();
+
+    if (! ok || num_ops > uint32_t(p_end - p)) {
+      ok = false;
+      break;
+    }
+
+    ops.clear();
+
+    for (uint32_t j = 0; j < num_ops; ++j) {
+      uint32_t type  = readInt();
+      uint32_t start = readInt();
+      uint32_t end   = readInt();
+      uint32_t arg   = readInt();
+      bool     paste = readInt();
+
+      if (type > uint32_t(DefineOpType::STRINGIZE) || start > end || end > num_tokens ||
+          arg > num_variables || (type != uint32_t(DefineOpType::TOKENS) && arg == 0))
+        ok = false;
+
+      ops.push_back(DefineOp(DefineOpType(type), int(start), int(end), int(arg) - 1, paste));
+    }
+
+    expand_counts.resize(num_variables);
+
+    for (auto &count : expand_counts)
+      count = int(readInt());
+
+    if (! ok)
+      break;
+
+    //---
+
+    // same as existing define is kept, a different one replaces it
+    Define *define = atom->define;
+
+    if (define) {
+      if (define->function == function && define->variables == variables &&
+          define->value == value)
+        continue;
+
+      warning("Redefinition of " + atom->name + " from " + define->value + " to " + value);
+
+      if (! define->baseline)
+        define_pool_.destroy(define);
+    }
+
+    define = define_pool_.create(atom, function, variables, value);
+
+    define->variable_atoms = variable_atoms;
+    define->value_ops      = ops;
+    define->expand_counts  = expand_counts;
+
+    const char *str = define->value.c_str();
+
+    define->value_tokens.resize(num_tokens);
+
+    for (uint32_t j = 0; j < num_tokens; ++j) {
+      const TokenData &data  = token_data[j];
+      Token           &token = define->value_tokens[j];
+
+      token      = Token(data.type, str + data.offset, int(data.len));
+      token.atom = data.atom;
+    }
+
+    atom->define = define;
+  }
+
+  //---
+
+  uint32_t num_guards = readInt();
+
+  std::string file;
+
+  for (uint32_t i = 0; ok && i < num_guards; ++i) {
+    FileGuard file_guard;
+
+    readString(file);
+    readString(file_guard.guard);
+
+    file_guard.once = readInt();
+
+    if (ok)
+      file_guards_[file] = file_guard;
+  }
+
+  //---
+
+  if (readInt()) {
+    Include *include = readInclude();
+
+    if (! current_include_)
+      current_include_ = include_pool_.create("");
+
+    for (const auto &include1 : include->includes)
+      current_include_->includes.push_back(include1);
+
+    include_pool_.destroy(include);
+  }
+
+  if (! ok) {
+    error("Truncated or invalid state file '" + fileName + "'");
+    return false;
+  }
+
+  return true;
+}
+
+void
+CPrePro::
+error(const std::string &msg)
+{
+  diagnostic(true, msg);
+}
+
+void
+CPrePro::
+warning(const std::string &msg)
+{
+  diagnostic(false, msg);
+}
+
+void
+CPrePro::
+diagnostic(bool error, const std::string &msg)
+{
+  if (capture_diagnostics_) {
+    Diagnostic diagnostic;
+
+    diagnostic.error   = error;
+    diagnostic.file    = current_file_;
+    diagnostic.line    = current_line_;
+    diagnostic.message = msg;
+
+    diagnostics_.push_back(diagnostic);
+  }
+  else
+    std::cerr << msg << " - " << current_file_ << ":" << current_line_ << "\n";
+
+  ++num_diagnostics_;
+}
+
+// parse non-negative integer option value (whole string must be digits)
+static bool parseOptionInt(const char *str, long &value)
+{
+  if (! str || ! isdigit(*str))
+    return false;
+
+  const char *end = str + strlen(str);
+
+  auto rc = std::from_chars(str, end, value);
+
+  return (rc.ec == std::errc() && rc.ptr == end);
+}
+
+void
+CPrePro::
+process_args(int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] == '-') {
+      if (argv[i][1] != '\0')
+        process_option(&argv[i][1], i, argv);
+    }
+    else
+      process_arg(argv[i]);
+  }
+}
+
+void
+CPrePro::
+process_option(const std::string &option, int &argc, char **argv)
+{
+  if      (option[0] == 'D')
+    add_define_option(option.substr(1));
+  else if (option[0] == 'I')
+    add_include_option(option.substr(1));
+  else if (option == "o") {
+    ++argc;
+
+    output_file_ = argv[argc];
+
+    int fd = ::open(output_file_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    if (fd >= 0)
+      output_.setFd(fd);
+    else
+      error("Failed to open output file '" + output_file_ + "'");
+  }
+  else if (option == "stdin")
+    add_file("");
+  else if (option == "output_thread")
+    output_.setBackground(true);
+  else if (option == "no_blank_lines")
+    no_blank_lines_ = true;
+  else if (option == "line_markers")
+    line_markers_ = true;
+  else if (option == "echo")
+    echo_input_ = true;
+  else if (option == "nostd" || option == "no_std")
+    no_std_ = true;
+  else if (option == "quiet")
+    quiet_ = true;
+  else if (option == "nowarn" || option == "no_warn")
+    warn_ = false;
+  else if (option == "debug")
+    debug_ = true;
+  else if (option == "list_includes")
+    list_includes_ = true;
+  else if (option == "dir_cache")
+    dir_cache_ = true;
+  else if (option == "M" || option == "MM") {
+    deps_only_   = true;
+    deps_no_std_ = (option == "MM");
+  }
+  else if (option == "MD" || option == "MMD") {
+    deps_file_   = true;
+    deps_no_std_ = (option == "MMD");
+  }
+  else if (option == "MF") {
+    ++argc;
+
+    deps_output_file_ = argv[argc];
+  }
+  else if (option == "MT") {
+    ++argc;
+
+    deps_targets_.push_back(argv[argc]);
+  }
+  else if (option == "MP")
+    deps_phony_ = true;
+  else if (option == "cache_dir") {
+    ++argc;
+
+    cache_dir_ = argv[argc];
+  }
+  else if (option == "cache_size") {
+    ++argc;
+
+    long size;
+
+    if (parseOptionInt(argv[argc], size) && size <= (1L << 40))
+      cache_size_ = size*1024*1024;
+    else
+      std::cerr << "Invalid cache size '" << (argv[argc] ? argv[argc] : "") <<
+                   "' (usage: -cache_size <MB>)\n";
+  }
+  else if (option == "simd") {
+    ++argc;
+
+    if (! CPreProScan::setImpl(argv[argc]))
+      error("Invalid simd '" + std::string(argv[argc]) + "'");
+  }
+  else if (option == "stats")
+    stats_ = true;
+  else if (option == "stats_json") {
+    stats_      = true;
+    stats_json_ = true;
+  }
+  else if (option == "save_state") {
+    ++argc;
+
+    save_state_file_ = argv[argc];
+  }
+  else if (option == "load_state") {
+    ++argc;
+
+    load_state(argv[argc]);
+  }
+  else if (option == "j" || (option[0] == 'j' && isdigit(option[1]))) {
+    const char *str = (option.size() > 1 ? option.c_str() + 1 : argv[++argc]);
+
+    long num_jobs;
+
+    if (parseOptionInt(str, num_jobs) && num_jobs <= 1024) {
+      num_jobs_ = int(num_jobs);
+
+      // 0 is number of hardware threads
+      if (num_jobs_ == 0)
+        num_jobs_ = int(std::thread::hardware_concurrency());
+    }
+    else
+      std::cerr << "Invalid job count '" << (str ? str : "") << "' (usage: -j <n> or -j<n>)\n";
+  }
+  else
+    std::cerr << "Invalid Option " << option << "\n";
+}
+
+void
+CPrePro::
+add_define_option(const std::string &name)
+{
+  std::string::size_type p = name.find('=');
+
+  VariableList variables;
+
+  if (p != std::string::npos) {
+    std::string name1  = name.substr(0, p);
+    std::string value1 = name.substr(p + 1);
+
+    add_define(name1, variables, value1);
+  }
+  else
+    add_define(name, variables, "1");
+}
+
+void
+CPrePro::
+add_include_option(const std::string &str)
+{
+  add_include_dir(str);
+}
+
+// initialize worker from main preprocessor (options, include dirs, shared caches
+// and command line defines)
+void
+CPrePro::
+init_worker(const CPrePro &prepro)
+{
+  include_dirs_     = prepro.include_dirs_;
+  std_include_dirs_ = prepro.std_include_dirs_;
+
+  no_blank_lines_ = prepro.no_blank_lines_;
+  line_markers_   = prepro.line_markers_;
+  echo_input_     = prepro.echo_input_;
+  no_std_         = prepro.no_std_;
+  quiet_          = prepro.quiet_;
+  warn_           = prepro.warn_;
+  debug_          = prepro.debug_;
+  dir_cache_      = prepro.dir_cache_;
+  stats_          = prepro.stats_;
+
+  deps_only_    = prepro.deps_only_;
+  deps_file_    = prepro.deps_file_;
+  deps_no_std_  = prepro.deps_no_std_;
+  deps_phony_   = prepro.deps_phony_;
+  deps_targets_ = prepro.deps_targets_;
+
+  cache_dir_  = prepro.cache_dir_;
+  cache_size_ = prepro.cache_size_;
+
+  shared_ = prepro.shared_;
+
+  file_guards_ = prepro.file_guards_;
+
+  std::vector<Define *> defines;
+
+  prepro.atoms_.getDefines(defines);
+
+  for (const auto &define : defines)
+    add_define(define->name(), define->variables, define->value, define->function);
+}
+
+void
+CPrePro::
+process_arg(const std::string &arg)
+{
+  add_file(arg);
+}
+
+void
+CPrePro::
+process_files()
+{
+  if (files_.empty())
+    add_file("");
+
+  int num_files = int(files_.size());
+
+  // state is saved from main preprocessor so files are processed in sequence
+  if (num_jobs_ > 1 && num_files > 1 && save_state_file_ == "") {
+    process_files_parallel();
+    return;
+  }
+
+  // result cache is only used for a single file as a cache hit does not update
+  // the defines seen by the next file
+  for (int i = 0; i < num_files; i++) {
+    if (num_files == 1)
+      process_input_file(files_[i]);
+    else
+      process_file(files_[i]);
+
+    add_dependency_rule(files_[i]);
+  }
+}
+
+// process each file in its own worker preprocessor on a pool of threads, output
+// is written in file order as each file completes
+void
+CPrePro::
+process_files_parallel()
+{
+  // worker is kept until its result is merged (include tree is copied from its pool)
+  struct FileResult {
+    std::string              output;
+    std::unique_ptr<CPrePro> prepro;
+    bool                     done { false };
+  };
+
+  int num_files = int(files_.size());
+  int num_jobs  = std::min(num_jobs_, num_files);
+
+  std::vector<FileResult> results(num_files);
+
+  std::mutex              mutex;
+  std::condition_variable cond;
+  std::atomic<int>        next_file { 0 };
+
+  auto worker = [&]() {
+    while (true) {
+      int i = next_file++;
+
+      if (i >= num_files)
+        break;
+
+      std::string output;
+
+      std::unique_ptr<CPrePro> prepro(new CPrePro);
+
+      prepro->init_worker(*this);
+
+      prepro->output_.setString(&output);
+
+      prepro->initialize();
+
+      prepro->process_input_file(files_[i]);
+
+      prepro->add_dependency_rule(files_[i]);
+
+      prepro->output_.setString(nullptr);
+
+      std::unique_lock<std::mutex> lock(mutex);
+
+      FileResult &result = results[i];
+
+      result.output = std::move(output);
+      result.prepro = std::move(prepro);
+      result.done   = true;
+
+      cond.notify_all();
+    }
+  };
+
+  std::vector<std::thread> threads;
+
+  for (int i = 0; i < num_jobs; ++i)
+    threads.push_back(std::thread(worker));
+
+  for (int i = 0; i < num_files; ++i) {
+    std::string output;
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    cond.wait(lock, [&]() { return results[i].done; });
+
+    std::swap(output, results[i].output);
+
+    lock.unlock();
+
+    {
+      CPreProPhaseTimer timer(this, Phase::OUTPUT);
+
+      output_.write(output.c_str(), output.size());
+    }
+
+    FileResult &result = results[i];
+
+    CPrePro *prepro = result.prepro.get();
+
+    stats_data_ += prepro->get_stats();
+
+    deps_rules_ += prepro->deps_rules_;
+
+    if (prepro->current_include_) {
+      if (! current_include_)
+        current_include_ = include_pool_.create("");
+
+      for (const auto &include : prepro->current_include_->includes)
+        current_include_->includes.push_back(copy_include(include));
+    }
+
+    result.prepro.reset();
+  }
+
+  for (auto &thread : threads)
+    thread.join();
+}
+
+// process input file using the result cache (if enabled). The cached output is
+// used if the files read to produce it are unchanged, otherwise the file is
+// processed and the result added to the cache (if there were no diagnostics).
+void
+CPrePro::
+process_input_file(const std::string &fileName)
+{
+  if (cache_dir_ == "" || fileName == "" || is_deps() || list_includes_ ||
+      save_state_file_ != "" || debug_ || echo_input_) {
+    process_file(fileName);
+    return;
+  }
+
+  FileDataP file_data = get_file_data(fileName);
+
+  if (! file_data) {
+    process_file(fileName);
+    return;
+  }
+
+  char key[32];
+
+  snprintf(key, sizeof(key), "%016llx", (unsigned long long) cache_key(fileName, *file_data));
+
+  std::string cacheFile = cache_dir_ + "/" + key + ".cppc";
+
+  if (read_cache(cacheFile)) {
+    ++stats_data_.result_cache_hits;
+    return;
+  }
+
+  ++stats_data_.result_cache_misses;
+
+  // capture output for cache
+  std::string output;
+
+  output_.flush();
+
+  std::string *save_output_string = output_.string();
+
+  output_.setString(&output);
+
+  cache_files_     .clear();
+  cache_file_set_  .clear();
+  cache_lookups_   .clear();
+  cache_lookup_set_.clear();
+
+  int num_diagnostics = num_diagnostics_;
+
+  cache_record_ = true;
+
+  process_file(fileName);
+
+  cache_record_ = false;
+
+  output_.setString(save_output_string);
+
+  output_.write(output.c_str(), output.size());
+
+  if (num_diagnostics_ == num_diagnostics) {
+    if (write_cache(cacheFile, output))
+      evict_cache();
+  }
+}
+
+// copy include tree (from another preprocessor's pool)
+CPrePro::Include *
+CPrePro::
+copy_include(const Include *include)
+{
+  Include *include1 = include_pool_.create(include->filename);
+
+  for (const auto &include2 : include->includes)
+    include1->includes.push_back(copy_include(include2));
+
+  return include1;
+}
+
+void
+CPrePro::
+process_file(const std::string &fileName, const std::string &key)
+{
+  std::string save_current_file = current_file_;
+  std::string save_current_path = current_path_;
+  std::string save_current_key  = current_key_;
+  uint        save_current_line = current_line_;
+
+  if (fileName != "")
+    current_file_ = fileName;
+  else
+    current_file_ = "<stdin>";
+
+  current_path_ = current_file_;
+  current_key_  = (key != "" ? key : fileName != "" ? file_key(fileName) : current_file_);
+  current_line_ = 0;
+
+  if (debug_)
+    std::cerr << "Processing file " << current_file_ << "\n";
+
+  FileDataP file_data;
+
+  if (fileName != "") {
+    file_data = get_file_data(fileName);
+
+    if (! file_data) {
+      error("Failed to read file '" + fileName + "'");
+
+      current_file_ = save_current_file;
+      current_path_ = save_current_path;
+      current_key_  = save_current_key;
+      current_line_ = save_current_line;
+
+      return;
+    }
+  }
+
+  if (cache_record_ && file_data)
+    add_cache_file(fileName, *file_data);
+
+  ++stats_data_.files_read;
+
+  // line marker for start of file (flag 1 for included file)
+  if (line_markers_)
+    output_line_marker(1, file_depth_ > 0 ? 1 : 0);
+
+  ++file_depth_;
+
+  // standard input is processed as it is read
+  if (file_data) {
+    stats_data_.bytes_in += long(file_data->size());
+
+    process_data(file_data->data(), file_data->size());
+  }
+  else
+    process_stream(STDIN_FILENO);
+
+  --file_depth_;
+
+  current_file_ = save_current_file;
+  current_path_ = save_current_path;
+  current_key_  = save_current_key;
+  current_line_ = save_current_line;
+}
+
+// process file contents
+void
+CPrePro::
+process_data(const char *data, size_t size)
+{
+  CPreProPhaseTimer timer(this, Phase::SCAN);
+
+  GuardDetect guard_detect;
+
+  GuardDetect *save_guard_detect = guard_detect_;
+  int          save_skip_depth   = skip_depth_;
+
+  guard_detect_ = &guard_detect;
+  skip_depth_   = 0;
+
+  process_lines(data, size);
+
+  // whole file is inside include guard so can skip when included again if guard is defined
+  if (guard_detect.state == GuardState::END)
+    file_guards_[current_key_].guard = guard_detect.guard;
+
+  guard_detect_ = save_guard_detect;
+  skip_depth_   = save_skip_depth;
+}
+
+// process file descriptor contents as they are read. Data is read in chunks and
+// complete lines (not ending in a continuation) are processed and output flushed
+// before reading more so memory use is constant (buffer only grows for a line
+// larger than the buffer).
+void
+CPrePro::
+process_stream(int fd)
+{
+  CPreProPhaseTimer timer(this, Phase::SCAN);
+
+  GuardDetect *save_guard_detect = guard_detect_;
+  int          save_skip_depth   = skip_depth_;
+
+  guard_detect_ = nullptr;
+  skip_depth_   = 0;
+
+  std::vector<char> buffer(65536);
+
+  size_t start = 0, end = 0;
+
+  bool eof = false;
+
+  // end of last line which is not continued in [start, end)
+  auto linesEnd = [&]() {
+    size_t pos = end;
+
+    while (pos > start) {
+      const char *p = static_cast<const char *>(memrchr(&buffer[start], '\n', pos - start));
+
+      if (! p)
+        break;
+
+      size_t pos1 = size_t(p - &buffer[0]);
+
+      bool continued = ((pos1 > start && p[-1] == '\\') ||
+                        (pos1 >= start + 3 && p[-3] == '?' && p[-2] == '?' && p[-1] == '/'));
+
+      if (! continued)
+        return pos1 + 1;
+
+      pos = pos1;
+    }
+
+    return start;
+  };
+
+  while (! eof) {
+    // make space for next chunk (move partial line to start or grow for long line)
+    if (end == buffer.size()) {
+      if (start > 0) {
+        memmove(&buffer[0], &buffer[start], end - start);
+
+        end  -= start;
+        start = 0;
+      }
+      else
+        buffer.resize(2*buffer.size());
+    }
+
+    ssize_t n;
+
+    {
+      CPreProPhaseTimer timer1(this, Phase::READ);
+
+      do {
+        n = ::read(fd, &buffer[end], buffer.size() - end);
+      } while (n < 0 && errno == EINTR);
+    }
+
+    if (n <= 0)
+      eof = true;
+    else {
+      end += size_t(n);
+
+      stats_data_.bytes_in += long(n);
+    }
+
+    size_t end1 = (eof ? end : linesEnd());
+
+    if (end1 > start) {
+      process_lines(&buffer[start], end1 - start);
+
+      start = end1;
+
+      output_.flush();
+    }
+
+    if (start == end)
+      start = end = 0;
+  }
+
+  guard_detect_ = save_guard_detect;
+  skip_depth_   = save_skip_depth;
+}
+
+// process lines of data (last line is processed even if it has no newline)
+void
+CPrePro::
+process_lines(const char *data, size_t size)
+{
+  // lines are views into the file data (only continuation lines and lines
+  // with trigraphs are copied)
+  const char *p     = data;
+  const char *p_end = p + size;
+
+  std::string trigraph_line;
+
+  auto nextLine = [&](std::string_view &line) {
+    if (p >= p_end)
+      return false;
+
+    const char *p1 = static_cast<const char *>(memchr(p, '\n', p_end - p));
+
+    if (! p1)
+      p1 = p_end;
+
+    line = std::string_view(p, p1 - p);
+
+    p = (p1 < p_end ? p1 + 1 : p_end);
+
+    ++current_line_;
+
+    if (line.find("??") != std::string_view::npos) {
+      trigraph_line.assign(line);
+
+      replace_trigraphs(trigraph_line);
+
+      line = trigraph_line;
+    }
+
+    if (echo_input_)
+      std::cerr << line << "\n";
+
+    return true;
+  };
+
+  std::string      line3;
+  std::string_view line;
+
+  while (true) {
+    // fast skip of inactive lines
+    if (! context_->processing && ! echo_input_)
+      skip_lines(p, p_end);
+
+    if (! nextLine(line))
+      break;
+
+    line_start_ = current_line_;
+
+    int len = int(line.size());
+
+    if (len > 0 && line[len - 1] == '\\') {
+      line3.assign(line.data(), len - 1);
+
+      std::string_view line4;
+
+      while (nextLine(line4)) {
+        len = int(line4.size());
+
+        if (len == 0 || line4[len - 1] != '\\') {
+          line3 += line4;
+          break;
+        }
+
+        line3.append(line4.data(), len - 1);
+      }
+
+      line = line3;
+    }
+
+    if (! in_comment_ && ! line.empty() && line[0] == '#')
+      process_line(line);
+    else
+      output_line(line);
+  }
+}
+
+// get (shared) mapped file contents. Files are opened without the cache lock held,
+// failed opens are not cached and no more files are cached once the cached
+// size reaches max_file_data_cache_size
+CPrePro::FileDataP
+CPrePro::
+get_file_data(const std::string &fileName)
+{
+  CPreProPhaseTimer timer(this, Phase::READ);
+
+  FileDataMap &file_data_map = shared_->file_data;
+
+  std::unique_lock<std::mutex> lock(shared_->mutex);
+
+  uint generation = shared_->generation;
+
+  FileDataP file_data;
+
+  auto pf = file_data_map.find(fileName);
+
+  if (pf != file_data_map.end()) {
+    if ((*pf).second.generation == generation)
+      return (*pf).second.file_data;
+
+    file_data = (*pf).second.file_data;
+  }
+
+  lock.unlock();
+
+  // file cached in previous generation is reused if unchanged
+  bool ok = (file_data && file_data->isCurrent(fileName));
+
+  if (! ok) {
+    file_data = std::make_shared<FileData>();
+
+    ok = file_data->open(fileName);
+  }
+
+  lock.lock();
+
+  pf = file_data_map.find(fileName);
+
+  if (pf != file_data_map.end()) {
+    FileDataEntry &entry = (*pf).second;
+
+    // use existing if another worker opened the file in the meantime
+    if (entry.generation == generation)
+      return entry.file_data;
+
+    shared_->file_data_size -= entry.file_data->size();
+
+    file_data_map.erase(pf);
+  }
+
+  // failed opens are not cached
+  if (! ok)
+    return FileDataP();
+
+  if (shared_->file_data_size + file_data->size() <= max_file_data_cache_size) {
+    FileDataEntry &entry = file_data_map[fileName];
+
+    entry.file_data  = file_data;
+    entry.generation = generation;
+
+    shared_->file_data_size += file_data->size();
+  }
+
+  return file_data;
+}
+
+// skip lines in inactive conditional until matching #else, #elif or #endif (only
+// lines starting with '#' are checked, nested conditionals are counted and comments
+// are tracked). p is left at start of first line to be processed. The nesting
+// depth is kept if the end of the data is reached (streamed input).
+void
+CPrePro::
+skip_lines(const char *&p, const char *p_end)
+{
+  auto isIdentChar = [](char c) { return isalnum(c) || c == '_'; };
+
+  int &depth = skip_depth_;
+
+  bool continued = false;
+
+  while (p < p_end) {
+    const char *p1 = static_cast<const char *>(memchr(p, '\n', p_end - p));
+
+    if (! p1)
+      p1 = p_end;
+
+    bool continuation = (p1 > p && (p1[-1] == '\\' || (p1 - p >= 3 && p1[-3] == '?' &&
+                                                     p1[-2] == '?' && p1[-1] == '/')));
+
+    if (! in_comment_ && ! continued) {
+      const char *p2 = nullptr;
+
+      if      (*p == '#')
+        p2 = p + 1;
+      else if (p1 - p >= 3 && p[0] == '?' && p[1] == '?' && p[2] == '=')
+        p2 = p + 3;
+
+      if (p2) {
+        while (p2 < p1 && (*p2 == ' ' || *p2 == '\t'))
+          ++p2;
+
+        const char *p3 = p2;
+
+        while (p3 < p1 && isIdentChar(*p3))
+          ++p3;
+
+        std::string_view command(p2, p3 - p2);
+
+        if      (command == "if" || command == "ifdef" || command == "ifndef")
+          ++depth;
+        else if (command == "endif") {
+          if (depth == 0)
+            return;
+
+          --depth;
+        }
+        else if (command == "else" || command == "elif") {
+          if (depth == 0)
+            return;
+        }
+      }
+    }
+
+    // track comments (skipping string and char literals)
+    const char *p2 = p;
+
+    while (p2 < p1) {
+      if (in_comment_) {
+        const char *p3 = static_cast<const char *>(memchr(p2, '*', p1 - p2));
+
+        if (! p3)
+          break;
+
+        if (p3 + 1 < p1 && p3[1] == '/') {
+          in_comment_ = false;
+
+          p2 = p3 + 2;
+        }
+        else
+          p2 = p3 + 1;
+      }
+      else {
+        const char *p3 = CPreProScan::findChar(p2, p1, '/', '"', '\'');
+
+        if (p3 >= p1)
+          break;
+
+        if (*p3 != '/') {
+          p2 = CPreProScan::skipLiteral(p3 + 1, p1, *p3);
+          continue;
+        }
+
+        if (p3 + 1 >= p1)
+          break;
+
+        if      (p3[1] == '*') {
+          in_comment_ = true;
+
+          p2 = p3 + 2;
+        }
+        else if (p3[1] == '/')
+          break;
+        else
+          p2 = p3 + 1;
+      }
+    }
+
+    continued = continuation;
+
+    p = (p1 < p_end ? p1 + 1 : p_end);
+
+    ++current_line_;
+
+    ++stats_data_.lines_skipped;
+  }
+}
+
+void
+CPrePro::
+process_line(std::string_view line)
+{
+  CPreProPhaseTimer timer(this, Phase::COMMANDS);
+
+  remove_comments(line, true, comment_line_);
+
+  text_buffer_.clear();
+
+  clear_hide_sets();
+
+  line_tokens_.clear();
+
+  {
+    CPreProPhaseTimer timer1(this, Phase::TOKENIZE);
+
+    tokenize(comment_line_.c_str(), int(comment_line_.size()), line_tokens_);
+
+    lookup_tokens(line_tokens_);
+  }
+
+  // skip '#' and get command name
+  int pos        = 1;
+  int num_tokens = int(line_tokens_.size());
+
+  while (pos < num_tokens && line_tokens_[pos].isSpace())
+    ++pos;
+
+  if (pos >= num_tokens)
+    return;
+
+  std::string command(line_tokens_[pos].str);
+
+  ++pos;
+
+  while (pos < num_tokens && line_tokens_[pos].isSpace())
+    ++pos;
+
+  while (num_tokens > pos && line_tokens_[num_tokens - 1].isSpace())
+    --num_tokens;
+
+  data_tokens_.assign(line_tokens_.begin() + pos, line_tokens_.begin() + num_tokens);
+
+  if (guard_detect_ && guard_detect_->state != GuardState::NONE)
+    detect_guard(command, data_tokens_);
+
+  process_command(command, data_tokens_);
+}
+
+// check for file wrapped in '#ifndef <guard>' (or '#if ! defined <guard>') ... '#endif'
+void
+CPrePro::
+detect_guard(const std::string &command, const Tokens &data)
+{
+  GuardDetect &detect = *guard_detect_;
+
+  if      (detect.state == GuardState::START) {
+    detect.state = GuardState::NONE;
+
+    int len = int(data.size());
+    int pos = 0;
+
+    auto skipSpace = [&]() {
+      while (pos < len && data[pos].isSpace())
+        ++pos;
+    };
+
+    if      (command == "ifndef") {
+      if (len > 0 && data[0].type == TokenType::IDENTIFIER)
+        pos = 1;
+    }
+    else if (command == "if") {
+      if (pos < len && data[pos].isPunct("!")) {
+        ++pos; skipSpace();
+
+        if (pos < len && data[pos].type == TokenType::IDENTIFIER && data[pos].str == "defined") {
+          ++pos; skipSpace();
+
+          bool bracket = (pos < len && data[pos].isPunct("("));
+
+          if (bracket) {
+            ++pos; skipSpace();
+          }
+
+          if (pos < len && data[pos].type == TokenType::IDENTIFIER) {
+            ++pos;
+
+            if (bracket) {
+              skipSpace();
+
+              if (pos < len && data[pos].isPunct(")"))
+                ++pos;
+              else
+                pos = 0;
+            }
+          }
+          else
+            pos = 0;
+        }
+        else
+          pos = 0;
+      }
+    }
+
+    if (pos > 0) {
+      skipSpace();
+
+      if (pos >= len) {
+        int i = 0;
+
+        while (data[i].type != TokenType::IDENTIFIER || data[i].str == "defined")
+          ++i;
+
+        detect.state = GuardState::IN_GUARD;
+        detect.guard = std::string(data[i].str);
+        detect.depth = int(context_stack_.size()) + 1;
+      }
+    }
+  }
+  else if (detect.state == GuardState::IN_GUARD) {
+    if (int(context_stack_.size()) != detect.depth)
+      return;
+
+    if      (command == "else" || command == "elif")
+      detect.state = GuardState::NONE;
+    else if (command == "endif")
+      detect.state = GuardState::END;
+  }
+  else if (detect.state == GuardState::END)
+    detect.state = GuardState::NONE;
+}
+
+void
+CPrePro::
+process_command(const std::string &command, const Tokens &data)
+{
+  if      (command == "if"     )
+    process_if_command     (data);
+  else if (command == "ifdef"  )
+    process_ifdef_command  (data);
+  else if (command == "ifndef" )
+    process_ifndef_command (data);
+  else if (command == "else"   )
+    process_else_command   (data);
+  else if (command == "elif"   )
+    process_elif_command   (data);
+  else if (command == "endif"  )
+    process_endif_command  (data);
+  else if (command == "define" )
+    process_define_command (data);
+  else if (command == "undef"  )
+    process_undef_command  (data);
+  else if (command == "include")
+    process_include_command(data);
+  else if (command == "error"  )
+    process_error_command  (data);
+  else if (command == "warning")
+    process_warning_command(data);
+  else if (command == "pragma" )
+    process_pragma_command (data);
+  else if (command == "line"   )
+    process_line_command   (data);
+  else if (isdigit(command[0])) {
+    // GNU line marker (# <line> "<file>" <flags>)
+    Tokens data1;
+
+    data1.push_back(Token(TokenType::NUMBER, command.c_str(), int(command.size())));
+    data1.push_back(Token(TokenType::SPACE, " ", 1));
+
+    data1.insert(data1.end(), data.begin(), data.end());
+
+    process_line_command(data1);
+  }
+  else
+    error("Command '" + command + "' not supported");
+}
+
+void
+CPrePro::
+process_if_command(const Tokens &data)
+{
+  start_context(false);
+
+  if (context_->active)
+    context_->processing = process_expression(data);
+  else
+    context_->processing = false;
+
+  context_->processed = context_->processing;
+}
+
+void
+CPrePro::
+process_ifdef_command(const Tokens &data)
+{
+  start_context(false);
+
+  if (context_->active) {
+    context_->processing = (! data.empty() && is_defined(data[0]));
+  }
+  else
+    context_->processing = false;
+
+  context_->processed = context_->processing;
+}
+
+void
+CPrePro::
+process_ifndef_command(const Tokens &data)
+{
+  start_context(false);
+
+  if (context_->active) {
+    context_->processing = (data.empty() || ! is_defined(data[0]));
+  }
+  else
+    context_->processing = false;
+
+  context_->processed = context_->processing;
+}
+
+void
+CPrePro::
+process_else_command(const Tokens &)
+{
+  if (context_->active) {
+    context_->processing = ! context_->processed;
+
+    context_->processed = true;
+  }
+  else
+    context_->processing = false;
+}
+
+void
+CPrePro::
+process_elif_command(const Tokens &data)
+{
+  // expression is only evaluated if no previous branch was processed
+  if (context_->active) {
+    if (! context_->processed) {
+      context_->processing = process_expression(data);
+      context_->processed  = context_->processing;
+    }
+    else
+      context_->processing = false;
+  }
+  else
+    context_->processing = false;
+}
+
+void
+CPrePro::
+process_endif_command(const Tokens &)
+{
+  if (! end_context())
+    error("if/endif mismatch");
+}
+
+void
+CPrePro::
+process_define_command(const Tokens &data)
+{
+  if (! context_->active || ! context_->processing)
+    return;
+
+  int pos = 0;
+  int len = int(data.size());
+
+  if (pos >= len || data[pos].type != TokenType::IDENTIFIER) {
+    error("Invalid define '" + tokens_to_string(data) + "'");
+    return;
+  }
+
+  std::string name(data[pos].str);
+
+  ++pos;
+
+  VariableList variables;
+
+  bool function = false;
+
+  // parameter list must immediately follow the name
+  if (pos < len && data[pos].isPunct("(")) {
+    function = true;
+
+    ++pos;
+
+    while (pos < len && data[pos].isSpace())
+      ++pos;
+
+    if (pos < len && ! data[pos].isPunct(")")) {
+      while (true) {
+        if (pos >= len || data[pos].type != TokenType::IDENTIFIER) {
+          error("Invalid define '" + tokens_to_string(data) + "'");
+          return;
+        }
+
+        variables.push_back(std::string(data[pos].str));
+
+        ++pos;
+
+        while (pos < len && data[pos].isSpace())
+          ++pos;
+
+        if (pos >= len || ! data[pos].isPunct(","))
+          break;
+
+        ++pos;
+
+        while (pos < len && data[pos].isSpace())
+          ++pos;
+      }
+    }
+
+    if (pos >= len || ! data[pos].isPunct(")")) {
+      error("Invalid define '" + tokens_to_string(data) + "'");
+      return;
+    }
+
+    ++pos;
+  }
+
+  while (pos < len && data[pos].isSpace())
+    ++pos;
+
+  std::string value;
+
+  for ( ; pos < len; ++pos)
+    value += data[pos].str;
+
+  add_define(name, variables, value, function);
+
+  ++stats_data_.defines_added;
+}
+
+void
+CPrePro::
+process_undef_command(const Tokens &data)
+{
+  if (! context_->active || ! context_->processing)
+    return;
+
+  if (data.empty())
+    return;
+
+  remove_define(std::string(data[0].str));
+}
+
+void
+CPrePro::
+process_include_command(const Tokens &data)
+{
+  if (! context_->active || ! context_->processing)
+    return;
+
+  replace_defines(data, true, expand_tokens_);
+
+  std::string data1 = tokens_to_string(expand_tokens_);
+
+  int len = int(data1.size());
+
+  if (len < 2) {
+    error("Illegal include syntax");
+    return;
+  }
+
+  char c;
+
+  if      (data1[0] == '\"')
+    c = '\"';
+  else if (data1[0] == '<')
+    c = '>';
+  else {
+    error("Illegal include syntax");
+    return;
+  }
+
+  int i = 1;
+
+  for (i = 1; i < len && data1[i] != c; ++i)
+    ;
+
+  std::string fileName = data1.substr(1, i - 1);
+
+  const IncludeFile include_file = get_include_file(fileName, c == '\"');
+
+  if (include_file.file == "") {
+    if (warn_)
+      warning("Failed to find include file '" + fileName + "'");
+    return;
+  }
+
+  if (is_deps())
+    add_dependency(include_file.file, include_file.std);
+
+  if (include_file.std && no_std_)
+    return;
+
+  // skip file if already included (by any path) and has #pragma once or include
+  // guard is defined
+  auto pg = file_guards_.find(include_file.key);
+
+  if (pg != file_guards_.end()) {
+    const FileGuard &file_guard = (*pg).second;
+
+    if (file_guard.once || (file_guard.guard != "" && get_define(file_guard.guard))) {
+      ++stats_data_.includes_skipped;
+      return;
+    }
+  }
+
+  Include *include = include_pool_.create(include_file.file);
+
+  if (! current_include_)
+    current_include_ = include_pool_.create("");
+
+  current_include_->includes.push_back(include);
+
+  std::swap(current_include_, include);
+
+  // file included from system header is also a system header
+  bool save_current_std = current_std_;
+
+  current_std_ = (current_std_ || include_file.std);
+
+  process_file(current_include_->filename, include_file.key);
+
+  current_std_ = save_current_std;
+
+  // line marker for return to including file (flag 2)
+  if (line_markers_)
+    output_line_marker(current_line_ + 1, 2);
+
+  std::swap(current_include_, include);
+}
+
+void
+CPrePro::
+process_error_command(const Tokens &data)
+{
+  if (! context_->active || ! context_->processing)
+    return;
+
+  error(tokens_to_string(data));
+}
+
+void
+CPrePro::
+process_warning_command(const Tokens &data)
+{
+  if (! context_->active || ! context_->processing)
+    return;
+
+  warning(tokens_to_string(data));
+}
+
+void
+CPrePro::
+process_pragma_command(const Tokens &data)
+{
+  if (! context_->active || ! context_->processing)
+    return;
+
+  if (! data.empty() && data[0].str == "once")
+    file_guards_[current_key_].once = true;
+}
+
+// #line <line> ["<file>"] : set line number of next line (and file name)
+void
+CPrePro::
+process_line_command(const Tokens &data)
+{
+  if (! context_->active || ! context_->processing)
+    return;
+
+  replace_defines(data, true, expand_tokens_);
+
+  int len = int(expand_tokens_.size());
+  int pos = 0;
+
+  auto skipSpace = [&]() {
+    while (pos < len && expand_tokens_[pos].isSpace())
+      ++pos;
+  };
+
+  skipSpace();
+
+  auto isDigits = [](std::string_view str) {
+    for (const auto &c : str)
+      if (! isdigit(c))
+        return false;
+
+    return ! str.empty();
+  };
+
+  if (pos >= len || expand_tokens_[pos].type != TokenType::NUMBER ||
+      ! isDigits(expand_tokens_[pos].str)) {
+    error("Invalid #line '" + tokens_to_string(data) + "'");
+    return;
+  }
+
+  // line number must fit in a (signed) int
+  std::string_view lineStr = expand_tokens_[pos].str;
+
+  unsigned long line = 0;
+
+  auto rc = std::from_chars(lineStr.data(), lineStr.data() + lineStr.size(), line);
+
+  if (rc.ec != std::errc() || line > 2147483647UL) {
+    error("Line number out of range '" + std::string(lineStr) + "'");
+    return;
+  }
+
+  ++pos;
+
+  skipSpace();
+
+  std::string fileName;
+
+  if (pos < len) {
+    std::string_view str = expand_tokens_[pos].str;
+
+    if (expand_tokens_[pos].type != TokenType::STRING || str[0] != '\"') {
+      error("Invalid #line '" + tokens_to_string(data) + "'");
+      return;
+    }
+
+    for (int i = 1; i < int(str.size()) - 1; ++i) {
+      if (str[i] == '\\' && i < int(str.size()) - 2)
+        ++i;
+
+      fileName += str[i];
+    }
+
+    current_file_ = fileName;
+  }
+
+  current_line_ = uint(line) - 1;
+}
+
+int
+CPrePro::
+process_expression(const Tokens &expression)
+{
+  CPreProPhaseTimer timer(this, Phase::EXPRESSION);
+
+  replace_defines(expression, true, expand_tokens_);
+
+  CPreProExpr expr(this, expand_tokens_);
+
+  CPreProExpr::Value value;
+
+  if (! expr.evaluate(value))
+    return false;
+
+  return (value.i != 0);
+}
+
+void
+CPrePro::
+output_line(std::string_view line)
+{
+  if (! context_->active || ! context_->processing)
+    return;
+
+  remove_comments(line, false, comment_line_);
+
+  // any non-blank line outside the include guard means the file is not guarded
+  if (guard_detect_ && (guard_detect_->state == GuardState::START ||
+                        guard_detect_->state == GuardState::END)) {
+    for (const auto &c : comment_line_) {
+      if (! isspace(c)) {
+        guard_detect_->state = GuardState::NONE;
+        break;
+      }
+    }
+  }
+
+  // dependencies only so no output (or define expansion) needed
+  if (quiet_ || deps_only_)
+    return;
+
+  text_buffer_.clear();
+
+  clear_hide_sets();
+
+  line_tokens_.clear();
+
+  {
+    CPreProPhaseTimer timer(this, Phase::TOKENIZE);
+
+    tokenize(comment_line_.c_str(), int(comment_line_.size()), line_tokens_);
+
+    lookup_tokens(line_tokens_);
+  }
+
+  replace_defines(line_tokens_, false, expand_tokens_);
+
+  // blank lines are replaced by line markers
+  if (no_blank_lines_ || line_markers_) {
+    bool blank = true;
+
+    for (const auto &token : expand_tokens_) {
+      if (! token.isSpace()) {
+        blank = false;
+        break;
+      }
+    }
+
+    if (blank) return;
+  }
+
+  if (line_markers_)
+    sync_line_marker();
+
+  output_tokens(expand_tokens_);
+
+  ++marker_line_;
+}
+
+// move output to current line : up to 8 blank lines are output for a small gap
+// otherwise a line marker is output
+void
+CPrePro::
+sync_line_marker()
+{
+  if (marker_file_ != current_file_ || line_start_ < marker_line_ ||
+      line_start_ > marker_line_ + 8) {
+    output_line_marker(line_start_);
+    return;
+  }
+
+  while (marker_line_ < line_start_) {
+    output_.put('\n');
+
+    ++marker_line_;
+
+    ++stats_data_.bytes_out;
+  }
+}
+
+// output GCC style line marker : # <line> "<file>" [flags]
+// (1 : start of file, 2 : return to file, 3 : system header)
+void
+CPrePro::
+output_line_marker(int line, int flag)
+{
+  if (quiet_ || deps_only_)
+    return;
+
+  std::string str = "# " + std::to_string(line) + " \"";
+
+  for (const auto &c : current_file_) {
+    if (c == '\\' || c == '\"')
+      str += '\\';
+
+    str += c;
+  }
+
+  str += "\"";
+
+  if (flag)
+    str += " " + std::to_string(flag);
+
+  if (current_std_)
+    str += " 3";
+
+  str += "\n";
+
+  {
+    CPreProPhaseTimer timer(this, Phase::OUTPUT);
+
+    output_.write(str.c_str(), str.size());
+  }
+
+  stats_data_.bytes_out += long(str.size());
+
+  marker_file_ = current_file_;
+  marker_line_ = line;
+}
+
+void
+CPrePro::
+output_tokens(const Tokens &tokens)
+{
+  CPreProPhaseTimer timer(this, Phase::OUTPUT);
+
+  for (const auto &token : tokens) {
+    output_.write(token.str.data(), token.str.size());
+
+    stats_data_.bytes_out += long(token.str.size());
+  }
+
+  output_.put('\n');
+
+  ++stats_data_.bytes_out;
+}
+
+void
+CPrePro::
+replace_trigraphs(std::string &line)
+{
+  CPreProPhaseTimer timer(this, Phase::TRIGRAPHS);
+
+  static const char trigraph_chars1[] = "=/\'()!<>-";
+  static const char trigraph_chars2[] = "#\\^[]|{}~";
+
+  // most lines have no trigraphs so only rewrite (in place) when needed
+  std::string::size_type p = line.find("??");
+
+  if (p == std::string::npos)
+    return;
+
+  int len = int(line.size());
+
+  int i = int(p);
+  int j = i;
+
+  while (i < len) {
+    if (i < len - 2 && line[i] == '?' && line[i + 1] == '?') {
+      const char *p1 = strchr(trigraph_chars1, line[i + 2]);
+
+      if (p1 && line[i + 2] != '\0') {
+        line[j++] = trigraph_chars2[p1 - trigraph_chars1];
+
+        i += 3;
+
+        continue;
+      }
+    }
+
+    line[j++] = line[i++];
+  }
+
+  line.resize(j);
+}
+
+// copy line with each comment replaced by a space. String and char literals are
+// skipped so comment chars inside them are kept, and text between comments is
+// copied in spans.
+void
+CPrePro::
+remove_comments(std::string_view line, bool preprocessor_line, std::string &line1)
+{
+  CPreProPhaseTimer timer(this, Phase::COMMENTS);
+
+  bool in_comment1;
+
+  if (preprocessor_line)
+    in_comment1 = false;
+  else
+    in_comment1 = in_comment_;
+
+  line1.clear();
+
+  const char *p     = line.data();
+  const char *p_end = p + line.size();
+
+  const char *start = p; // start of text to copy
+
+  while (p < p_end) {
+    if (in_comment1) {
+      const char *p1 = static_cast<const char *>(memchr(p, '*', p_end - p));
+
+      if (! p1) {
+        p = p_end;
+        break;
+      }
+
+      if (p1 + 1 < p_end && p1[1] == '/') {
+        in_comment1 = false;
+
+        p = start = p1 + 2;
+      }
+      else
+        p = p1 + 1;
+
+      continue;
+    }
+
+    const char *p1 = CPreProScan::findChar(p, p_end, '/', '"', '\'');
+
+    if (p1 >= p_end) {
+      p = p_end;
+      break;
+    }
+
+    if (*p1 != '/') {
+      p = CPreProScan::skipLiteral(p1 + 1, p_end, *p1);
+      continue;
+    }
+
+    char c1 = (p1 + 1 < p_end ? p1[1] : '\0');
+
+    if      (c1 == '*') {
+      line1.append(start, p1 - start);
+      line1 += ' ';
+
+      in_comment1 = true;
+
+      p = p1 + 2;
+    }
+#ifdef CPP_SUPPORT
+    else if (c1 == '/') {
+      line1.append(start, p1 - start);
+      line1 += ' ';
+
+      start = p = p_end;
+    }
+#endif
+    else
+      p = p1 + 1;
+  }
+
+  if (! in_comment1)
+    line1.append(start, p_end - start);
+
+  if (preprocessor_line)
+    in_comment_ = false;
+  else
+    in_comment_ = in_comment1;
+}
+
+void
+CPrePro::
+tokenize(const char *str, int len, Tokens &tokens)
+{
+  struct Punct {
+    const char *str;
+    int         len;
+  };
+
+  // multi-character punctuators (longest first)
+  static const Punct puncts[] = {
+    {"%:%:", 4}, {"...", 3}, {"<<=", 3}, {">>=", 3},
+    {"->", 2}, {"++", 2}, {"--", 2}, {"<<", 2}, {">>", 2}, {"<=", 2}, {">=", 2}, {"==", 2},
+    {"!=", 2}, {"&&", 2}, {"||", 2}, {"*=", 2}, {"/=", 2}, {"%=", 2}, {"+=", 2}, {"-=", 2},
+    {"&=", 2}, {"^=", 2}, {"|=", 2}, {"##", 2}, {"<:", 2}, {":>", 2}, {"<%", 2}, {"%>", 2},
+    {"%:", 2}, {nullptr, 0}
+  };
+
+  static const char punct_chars[] = "[](){}.&*+-~!/%<>^|?:;=,#";
+
+  auto isIdentChar = [](char c) { return isalnum(c) || c == '_'; };
+
+  int pos = 0;
+
+  while (pos < len) {
+    int  pos1 = pos;
+    char c    = str[pos];
+
+    TokenType type = TokenType::OTHER;
+
+    if      (c == ' ' || c == '\t' || c == '\f' || c == '\v' || c == '\r') {
+      ++pos;
+
+      while (pos < len && (str[pos] == ' ' || str[pos] == '\t' || str[pos] == '\f' ||
+                           str[pos] == '\v' || str[pos] == '\r'))
+        ++pos;
+
+      type = TokenType::SPACE;
+    }
+    else if (isalpha(c) || c == '_') {
+      ++pos;
+
+      while (pos < len && isIdentChar(str[pos]))
+        ++pos;
+
+      type = TokenType::IDENTIFIER;
+    }
+    else if (isdigit(c) || (c == '.' && pos < len - 1 && isdigit(str[pos + 1]))) {
+      ++pos;
+
+      while (pos < len) {
+        if      ((str[pos] == '+' || str[pos] == '-') &&
+                 strchr("eEpP", str[pos - 1]))
+          ++pos;
+        else if (isIdentChar(str[pos]) || str[pos] == '.')
+          ++pos;
+        else
+          break;
+      }
+
+      type = TokenType::NUMBER;
+    }
+    else if (c == '\"' || c == '\'') {
+      ++pos;
+
+      while (pos < len && str[pos] != c) {
+        if (str[pos] == '\\' && pos < len - 1)
+          ++pos;
+
+        ++pos;
+      }
+
+      if (pos < len)
+        ++pos;
+
+      type = (c == '\"' ? TokenType::STRING : TokenType::CHAR);
+    }
+    else if (c != '\0' && strchr(punct_chars, c)) {
+      int plen = 1;
+
+      if (pos < len - 1 && strchr(punct_chars, str[pos + 1]) && str[pos + 1] != '\0') {
+        for (int i = 0; puncts[i].str; ++i) {
+          if (pos + puncts[i].len <= len &&
+              strncmp(&str[pos], puncts[i].str, puncts[i].len) == 0) {
+            plen = puncts[i].len;
+            break;
+          }
+        }
+      }
+
+      pos += plen;
+
+      type = TokenType::PUNCT;
+    }
+    else
+      ++pos;
+
+    tokens.push_back(Token(type, &str[pos1], pos - pos1));
+  }
+}
+
+std::string
+CPrePro::
+tokens_to_string(const Tokens &tokens)
+{
+  std::string str;
+
+  for (const auto &token : tokens)
+    str += token.str;
+
+  return str;
+}
+
+void
+CPrePro::
+replace_defines(const Tokens &tokens, bool preprocessor_line, Tokens &result)
+{
+  CPreProPhaseTimer timer(this, Phase::EXPAND);
+
+  result.clear();
+
+  if (tokens.empty())
+    return;
+
+  expand_tokens(tokens.data(), int(tokens.size()), preprocessor_line, result);
+
+  trim_expand_scratch();
+}
+
+// expand defines in token list (Prosser's algorithm). Each replaced define is added
+// to the hide set of the tokens it produces so a define is never replaced inside
+// its own expansion. Replacement tokens are pushed back onto the input so they are
+// rescanned along with the rest of the line in a single forward pass.
+//
+// Pushed back tokens are kept on a stack (in reverse order) which is read before
+// the remaining input tokens so each replacement is only moved once and expansion
+// is linear in the number of tokens produced.
+void
+CPrePro::
+expand_tokens(const Token *tokens, int num_tokens, bool preprocessor_line, Tokens &result)
+{
+  ExpandScratch &scratch = expand_scratch(expand_depth_);
+
+  Tokens   &stack      = scratch.stack;
+  Tokens   &arg_tokens = scratch.arg_tokens;
+  ArgSpans &args       = scratch.args;
+  Tokens   &tokens1    = scratch.replacement;
+
+  stack.clear();
+
+  // arguments are expanded at the next depth
+  ++expand_depth_;
+
+  int pos = 0;
+
+  // token at offset from next input token and number of input tokens left
+  auto at = [&](int i) -> const Token & {
+    int n = int(stack.size());
+
+    return (i < n ? stack[n - 1 - i] : tokens[pos + i - n]);
+  };
+
+  auto numLeft = [&]() { return int(stack.size()) + num_tokens - pos; };
+
+  auto skip = [&](int n) {
+    int n1 = std::min(n, int(stack.size()));
+
+    stack.resize(stack.size() - n1);
+
+    pos += n - n1;
+  };
+
+  while (true) {
+    // non identifiers are output directly from stack or input
+    if (! stack.empty()) {
+      if (stack.back().type != TokenType::IDENTIFIER) {
+        result.push_back(stack.back());
+        stack.pop_back();
+        continue;
+      }
+    }
+    else if (pos < num_tokens) {
+      if (tokens[pos].type != TokenType::IDENTIFIER) {
+        result.push_back(tokens[pos++]);
+        continue;
+      }
+    }
+    else
+      break;
+
+    Token token = at(0);
+
+    int len = numLeft();
+
+    if (preprocessor_line && token.str == "defined") {
+      int pos1 = 1;
+
+      while (pos1 < len && at(pos1).isSpace())
+        ++pos1;
+
+      bool bracket = (pos1 < len && at(pos1).isPunct("("));
+
+      if (bracket) {
+        ++pos1;
+
+        while (pos1 < len && at(pos1).isSpace())
+          ++pos1;
+      }
+
+      if (pos1 < len && at(pos1).type == TokenType::IDENTIFIER) {
+        const Token &name = at(pos1++);
+
+        bool defined = is_defined(name);
+
+        if (bracket) {
+          while (pos1 < len && at(pos1).isSpace())
+            ++pos1;
+
+          if (pos1 < len && at(pos1).isPunct(")"))
+            ++pos1;
+        }
+
+        result.push_back(Token(TokenType::NUMBER, (defined ? "1" : "0"), 1));
+
+        skip(pos1);
+
+        continue;
+      }
+    }
+
+    // __has_include("file") or __has_include(<file>) (file name is not expanded)
+    if (preprocessor_line && token.str == "__has_include") {
+      int pos1 = 1;
+
+      auto skipSpace = [&]() {
+        while (pos1 < len && at(pos1).isSpace())
+          ++pos1;
+      };
+
+      skipSpace();
+
+      if (pos1 < len && at(pos1).isPunct("(")) {
+        ++pos1;
+
+        skipSpace();
+
+        std::string fileName;
+        bool        quoted = false;
+        bool        valid  = false;
+
+        if      (pos1 < len && at(pos1).type == TokenType::STRING) {
+          std::string_view str = at(pos1++).str;
+
+          fileName = std::string(str.substr(1, str.size() - 2));
+          quoted   = true;
+          valid    = true;
+        }
+        else if (pos1 < len && at(pos1).isPunct("<")) {
+          ++pos1;
+
+          while (pos1 < len && ! at(pos1).isPunct(">"))
+            fileName += at(pos1++).str;
+
+          if (pos1 < len) {
+            ++pos1;
+
+            valid = true;
+          }
+        }
+
+        skipSpace();
+
+        if (valid && pos1 < len && at(pos1).isPunct(")")) {
+          ++pos1;
+
+          bool found = (get_include_file(fileName, quoted).file != "");
+
+          result.push_back(Token(TokenType::NUMBER, (found ? "1" : "0"), 1));
+
+          skip(pos1);
+
+          continue;
+        }
+      }
+    }
+
+    Define *define = get_define(token);
+
+    if (! define || hide_set_contains(token.hide_set, define)) {
+      result.push_back(token);
+      skip(1);
+      continue;
+    }
+
+    int hide_set = 0;
+    int end      = 1;
+
+    args      .clear();
+    arg_tokens.clear();
+
+    if (define->function) {
+      // get bracketed, comma separated argument list
+      int pos1 = 1;
+
+      while (pos1 < len && at(pos1).isSpace())
+        ++pos1;
+
+      if (pos1 >= len || ! at(pos1).isPunct("(")) {
+        result.push_back(token);
+        skip(1);
+        continue;
+      }
+
+      ++pos1;
+
+      // arguments are copied (in order) and split into ranges (between brackets
+      // and commas)
+      ArgSpan arg;
+
+      int  brackets = 0;
+      bool closed   = false;
+
+      while (pos1 < len) {
+        const Token &token1 = at(pos1++);
+
+        if      (token1.isPunct("("))
+          ++brackets;
+        else if (token1.isPunct(")")) {
+          if (brackets <= 0) {
+            // hide set is intersection of define name and closing bracket hide sets
+            hide_set = hide_set_intersect(token.hide_set, token1.hide_set);
+
+            closed = true;
+
+            break;
+          }
+
+          --brackets;
+        }
+        else if (token1.isPunct(",") && brackets <= 0) {
+          arg.end = int(arg_tokens.size());
+
+          args.push_back(arg);
+
+          arg.start = arg.end;
+
+          continue;
+        }
+
+        arg_tokens.push_back(token1);
+      }
+
+      if (! closed) {
+        result.push_back(token);
+        skip(1);
+        continue;
+      }
+
+      arg.end = int(arg_tokens.size());
+
+      args.push_back(arg);
+
+      // strip leading and trailing space
+      for (auto &arg1 : args) {
+        while (arg1.start < arg1.end && arg_tokens[arg1.start].isSpace())
+          ++arg1.start;
+
+        while (arg1.end > arg1.start && arg_tokens[arg1.end - 1].isSpace())
+          --arg1.end;
+      }
+
+      // no variables matches single empty argument
+      if (define->variables.empty() && args.size() == 1 && args[0].start == args[0].end)
+        args.clear();
+
+      if (args.size() != define->variables.size()) {
+        result.push_back(token);
+        skip(1);
+        continue;
+      }
+
+      end = pos1;
+    }
+    else
+      hide_set = token.hide_set;
+
+    hide_set = hide_set_add(hide_set, define);
+
+    ++stats_data_.defines_expanded;
+
+    stats_data_.max_expand_depth =
+      std::max(stats_data_.max_expand_depth, long(hide_sets_[hide_set].size()));
+
+    tokens1.clear();
+
+    substitute_define(define, arg_tokens.data(), args, hide_set, preprocessor_line, tokens1);
+
+    // replace define (and arguments) in input with replacement tokens
+    skip(end);
+
+    stack.insert(stack.end(), tokens1.rbegin(), tokens1.rend());
+  }
+
+  --expand_depth_;
+}
+
+void
+CPrePro::
+substitute_define(Define *define, const Token *input, const ArgSpans &args, int hide_set,
+                  bool preprocessor_line, Tokens &result)
+{
+  const Tokens &tokens = define->value_tokens;
+
+  int start = int(result.size());
+
+  // arguments used more than once are expanded once into cache (scratch of the
+  // calling expand_tokens level)
+  ExpandScratch &scratch = expand_scratch(expand_depth_ - 1);
+
+  ArgTokensList &expanded_args = scratch.expanded_args;
+  ArgCounts     &expanded      = scratch.expanded;
+
+  bool expanded_init = false;
+
+  // number of tokens added by last operation (paste only if non-zero, i.e. an
+  // empty argument is a place marker)
+  int num_added = 0;
+
+  for (const auto &op : define->value_ops) {
+    int size = int(result.size());
+
+    bool paste = (op.paste && num_added > 0);
+
+    switch (op.type) {
+      case DefineOpType::TOKENS: {
+        if (paste) {
+          paste_token(result, start, tokens[op.start]);
+
+          result.insert(result.end(), tokens.begin() + op.start + 1, tokens.begin() + op.end);
+        }
+        else
+          result.insert(result.end(), tokens.begin() + op.start, tokens.begin() + op.end);
+
+        break;
+      }
+      case DefineOpType::ARG: {
+        const ArgSpan &arg = args[op.arg];
+
+        if (paste && arg.end > arg.start) {
+          paste_token(result, start, input[arg.start]);
+
+          result.insert(result.end(), input + arg.start + 1, input + arg.end);
+        }
+        else
+          result.insert(result.end(), input + arg.start, input + arg.end);
+
+        break;
+      }
+      case DefineOpType::EXPAND_ARG: {
+        const ArgSpan &arg = args[op.arg];
+
+        if (define->expand_counts[op.arg] <= 1) {
+          expand_tokens(input + arg.start, arg.end - arg.start, preprocessor_line, result);
+
+          break;
+        }
+
+        if (! expanded_init) {
+          if (expanded_args.size() < args.size())
+            expanded_args.resize(args.size());
+
+          expanded.assign(args.size(), 0);
+
+          expanded_init = true;
+        }
+
+        Tokens &expanded_arg = expanded_args[op.arg];
+
+        if (! expanded[op.arg]) {
+          expanded_arg.clear();
+
+          expand_tokens(input + arg.start, arg.end - arg.start, preprocessor_line,
+                        expanded_arg);
+
+          expanded[op.arg] = 1;
+        }
+
+        result.insert(result.end(), expanded_arg.begin(), expanded_arg.end());
+
+        break;
+      }
+      case DefineOpType::STRINGIZE: {
+        const ArgSpan &arg = args[op.arg];
+
+        stringize_arg(input + arg.start, arg.end - arg.start, result);
+
+        if (paste) {
+          Token token = result.back();
+
+          result.pop_back();
+
+          paste_token(result, start, token);
+        }
+
+        break;
+      }
+    }
+
+    num_added = int(result.size()) - size;
+
+    // pasted token replaces previous
+    if (paste)
+      ++num_added;
+  }
+
+  //---
+
+  // add define's hide set to replacement tokens
+  int num_tokens = int(result.size());
+
+  int hide_set1 = -1, hide_set2 = -1;
+
+  for (int i = start; i < num_tokens; ++i) {
+    if (result[i].hide_set != hide_set1) {
+      hide_set1 = result[i].hide_set;
+      hide_set2 = hide_set_union(hide_set1, hide_set);
+    }
+
+    result[i].hide_set = hide_set2;
+  }
+}
+
+void
+CPrePro::
+stringize_arg(const Token *arg, int len, Tokens &result)
+{
+  std::string &str = stringize_str_;
+
+  str = "\"";
+
+  for (int i = 0; i < len; ++i) {
+    const Token &token = arg[i];
+
+    if      (token.isSpace())
+      str += ' ';
+    else if (token.type == TokenType::STRING || token.type == TokenType::CHAR) {
+      for (const auto &c : token.str) {
+        if (c == '\"' || c == '\\')
+          str += '\\';
+
+        str += c;
+      }
+    }
+    else
+      str += token.str;
+  }
+
+  str += "\"";
+
+  const char *str1 = text_buffer_.add(str.c_str(), int(str.size()));
+
+  result.push_back(Token(TokenType::STRING, str1, int(str.size())));
+}
+
+void
+CPrePro::
+paste_token(Tokens &tokens, int start, const Token &token)
+{
+  while (int(tokens.size()) > start && tokens.back().isSpace())
+    tokens.pop_back();
+
+  if (int(tokens.size()) <= start) {
+    tokens.push_back(token);
+    return;
+  }
+
+  Token &token1 = tokens.back();
+
+  std::string str(token1.str);
+
+  str += token.str;
+
+  // pasted text must lex as a single token, otherwise the tokens are left unpasted
+  Tokens &paste_tokens = paste_tokens_;
+
+  paste_tokens.clear();
+
+  tokenize(str.c_str(), int(str.size()), paste_tokens);
+
+  // encoding prefix and string/char is a single literal
+  auto isPrefixedLiteral = [&]() {
+    if (paste_tokens.size() != 2 || paste_tokens[0].type != TokenType::IDENTIFIER)
+      return false;
+
+    std::string_view prefix = paste_tokens[0].str;
+
+    return ((prefix == "L" || prefix == "u" || prefix == "U" || prefix == "u8") &&
+            (paste_tokens[1].type == TokenType::STRING ||
+             paste_tokens[1].type == TokenType::CHAR));
+  };
+
+  TokenType type;
+
+  if      (paste_tokens.size() == 1)
+    type = paste_tokens[0].type;
+  else if (isPrefixedLiteral())
+    type = paste_tokens[1].type;
+  else {
+    warning("Pasting \"" + std::string(token1.str) + "\" and \"" + std::string(token.str) +
+            "\" does not give a valid preprocessing token");
+
+    tokens.push_back(Token(TokenType::SPACE, " ", 1));
+    tokens.push_back(token);
+
+    return;
+  }
+
+  const char *str1 = text_buffer_.add(str.c_str(), int(str.size()));
+
+  Token token2(type, str1, int(str.size()));
+
+  if (token2.type == TokenType::IDENTIFIER)
+    token2.atom = lookup(str1, int(str.size()));
+
+  token2.hide_set = hide_set_intersect(token1.hide_set, token.hide_set);
+
+  token1 = token2;
+}
+
+bool
+CPrePro::
+hide_set_contains(int hide_set, Define *define) const
+{
+  if (hide_set == 0)
+    return false;
+
+  const HideSet &hide_set1 = hide_sets_[hide_set];
+
+  return std::binary_search(hide_set1.begin(), hide_set1.end(), define);
+}
+
+int
+CPrePro::
+hide_set_add(int hide_set, Define *define)
+{
+  if (hide_set_contains(hide_set, define))
+    return hide_set;
+
+  HideSet &hide_set1 = hide_set_scratch_;
+
+  hide_set1 = hide_sets_[hide_set];
+
+  hide_set1.insert(std::lower_bound(hide_set1.begin(), hide_set1.end(), define), define);
+
+  return add_hide_set(hide_set1);
+}
+
+int
+CPrePro::
+hide_set_union(int hide_set1, int hide_set2)
+{
+  if (hide_set1 == hide_set2 || hide_set2 == 0)
+    return hide_set1;
+
+  if (hide_set1 == 0)
+    return hide_set2;
+
+  const HideSet &hide_set3 = hide_sets_[hide_set1];
+  const HideSet &hide_set4 = hide_sets_[hide_set2];
+
+  // no new set needed if one contains the other
+  if (std::includes(hide_set3.begin(), hide_set3.end(), hide_set4.begin(), hide_set4.end()))
+    return hide_set1;
+
+  if (std::includes(hide_set4.begin(), hide_set4.end(), hide_set3.begin(), hide_set3.end()))
+    return hide_set2;
+
+  HideSet &hide_set5 = hide_set_scratch_;
+
+  hide_set5.clear();
+
+  std::set_union(hide_set3.begin(), hide_set3.end(), hide_set4.begin(), hide_set4.end(),
+                 std::back_inserter(hide_set5));
+
+  return add_hide_set(hide_set5);
+}
+
+int
+CPrePro::
+hide_set_intersect(int hide_set1, int hide_set2)
+{
+  if (hide_set1 == hide_set2 || hide_set1 == 0)
+    return hide_set1;
+
+  if (hide_set2 == 0)
+    return hide_set2;
+
+  const HideSet &hide_set3 = hide_sets_[hide_set1];
+  const HideSet &hide_set4 = hide_sets_[hide_set2];
+
+  HideSet &hide_set5 = hide_set_scratch_;
+
+  hide_set5.clear();
+
+  std::set_intersection(hide_set3.begin(), hide_set3.end(), hide_set4.begin(), hide_set4.end(),
+                        std::back_inserter(hide_set5));
+
+  if (hide_set5.empty()                  ) return 0;
+  if (hide_set5.size() == hide_set3.size()) return hide_set1;
+  if (hide_set5.size() == hide_set4.size()) return hide_set2;
+
+  return add_hide_set(hide_set5);
+}
+
+int
+CPrePro::
+add_hide_set(const HideSet &hide_set)
+{
+  // reuse storage of hide sets from previous lines
+  if (num_hide_sets_ < int(hide_sets_.size()))
+    hide_sets_[num_hide_sets_] = hide_set;
+  else
+    hide_sets_.push_back(hide_set);
+
+  return num_hide_sets_++;
+}
+
+// remove all hide sets except the empty set (index 0) for new line. Storage is
+// kept unless a pathological line created a large number of sets.
+void
+CPrePro::
+clear_hide_sets()
+{
+  if (hide_sets_.empty() || hide_sets_.size() > max_scratch_size)
+    hide_sets_.resize(1);
+
+  hide_sets_[0].clear();
+
+  num_hide_sets_ = 1;
+}
+
+// get scratch space for expansion depth
+CPrePro::ExpandScratch &
+CPrePro::
+expand_scratch(int depth)
+{
+  while (int(expand_scratch_.size()) <= depth)
+    expand_scratch_.push_back(std::make_unique<ExpandScratch>());
+
+  return *expand_scratch_[depth];
+}
+
+// release scratch buffers grown larger than max_scratch_size by a large line
+void
+CPrePro::
+trim_expand_scratch()
+{
+  auto trim = [](auto &v) {
+    if (v.capacity() > max_scratch_size)
+      std::remove_reference_t<decltype(v)>().swap(v);
+  };
+
+  for (auto &scratch : expand_scratch_) {
+    trim(scratch->stack);
+    trim(scratch->arg_tokens);
+    trim(scratch->args);
+    trim(scratch->replacement);
+    trim(scratch->expanded);
+
+    for (auto &arg : scratch->expanded_args)
+      trim(arg);
+
+    trim(scratch->expanded_args);
+  }
+
+  trim(hide_set_scratch_);
+}
+
+void
+CPrePro::
+add_file(const std::string &fileName)
+{
+  files_.push_back(fileName);
+}
+
+void
+CPrePro::
+add_define(const std::string &name, const VariableList &variables, const std::string &value,
+           bool function)
+{
+  if (debug_) {
+    if (! variables.empty()) {
+      std::cerr << "Add Define " << name << "(";
+
+      int num_variables = int(variables.size());
+
+      for (int i = 0; i < num_variables; i++) {
+        if (i > 0)
+          std::cerr << ", ";
+
+        std::cerr << variables[i];
+      }
+
+      std::cerr << ")=" << value << "\n";
+    }
+    else
+      std::cerr << "Add Define " << name << "=" << value << "\n";
+  }
+
+  Atom *atom = intern(name.c_str(), int(name.size()));
+
+  Define *define = atom->define;
+
+  if (! define) {
+    define = define_pool_.create(atom, function, variables, value);
+
+    compile_define(define);
+
+    atom->define = define;
+
+    return;
+  }
+
+  bool redefined = false;
+
+  if (define->value != value)
+    redefined = true;
+
+  if (define->function != function || define->variables.size() != variables.size())
+    redefined = true;
+
+  if (! redefined && ! define->variables.empty()) {
+    int num_variables = int(define->variables.size());
+
+    for (int i = 0; i < num_variables; i++) {
+      if (define->variables[i] != variables[i]) {
+        redefined = true;
+        break;
+      }
+    }
+  }
+
+  if (redefined)
+    warning("Redefinition of " + name + " from " + define->value + " to " + value);
+
+  // baseline define is shared so replace instead of modify
+  if (define->baseline) {
+    if (! redefined)
+      return;
+
+    define = define_pool_.create(atom, function, variables, value);
+
+    compile_define(define);
+
+    atom->define = define;
+
+    return;
+  }
+
+  define->function  = function;
+  define->variables = variables;
+  define->value     = value;
+
+  compile_define(define);
+}
+
+// split define value into replacement tokens and compile into operations (token
+// ranges, argument references, stringize and paste) so expansion only has to
+// splice in arguments
+void
+CPrePro::
+compile_define(Define *define)
+{
+  Tokens    &tokens = define->value_tokens;
+  DefineOps &ops    = define->value_ops;
+
+  tokens.clear();
+  ops   .clear();
+
+  tokenize(define->value.c_str(), int(define->value.size()), tokens);
+
+  intern_tokens(tokens);
+
+  int num_variables = int(define->variables.size());
+
+  define->expand_counts.assign(num_variables, 0);
+
+  define->variable_atoms.clear();
+
+  for (const auto &variable : define->variables)
+    define->variable_atoms.push_back(intern(variable.c_str(), int(variable.size())));
+
+  auto variableIndex = [&](int pos) {
+    if (! define->function || ! tokens[pos].atom)
+      return -1;
+
+    for (int i = 0; i < num_variables; ++i)
+      if (define->variable_atoms[i] == tokens[pos].atom)
+        return i;
+
+    return -1;
+  };
+
+  int len = int(tokens.size());
+
+  auto nextNonSpace = [&](int pos) {
+    while (pos < len && tokens[pos].isSpace())
+      ++pos;
+
+    return pos;
+  };
+
+  bool paste = false;
+
+  for (int pos = 0; pos < len; ++pos) {
+    const Token &token = tokens[pos];
+
+    // #<arg> - stringize argument
+    if (define->function && token.isPunct("#")) {
+      int pos1 = nextNonSpace(pos + 1);
+      int i    = (pos1 < len ? variableIndex(pos1) : -1);
+
+      if (i >= 0) {
+        ops.push_back(DefineOp(DefineOpType::STRINGIZE, 0, 0, i, paste));
+
+        paste = false;
+        pos   = pos1;
+
+        continue;
+      }
+    }
+
+    // ## - remove surrounding space and paste next token
+    if (token.isPunct("##") && ! ops.empty()) {
+      DefineOp &op = ops.back();
+
+      if (op.type == DefineOpType::TOKENS) {
+        while (op.end > op.start && tokens[op.end - 1].isSpace())
+          --op.end;
 
- private:
-  CPrePro *prepro_ { nullptr };
-};
+        if (op.end == op.start)
+          ops.pop_back();
+      }
 
-extern int
-main(int argc, char **argv)
-{
-  CPrePro prepro;
+      paste = true;
+      pos   = nextNonSpace(pos + 1) - 1;
 
-  prepro.initialize();
+      continue;
+    }
 
-  prepro.process_args(argc, argv);
+    int i = variableIndex(pos);
 
-  prepro.process_files();
+    if (i >= 0) {
+      // argument next to ## is not expanded
+      int pos1 = nextNonSpace(pos + 1);
 
-  prepro.terminate();
+      bool hash_hash_after = (pos1 < len && tokens[pos1].isPunct("##"));
 
-  return 0;
-}
+      DefineOpType type = (paste || hash_hash_after ?
+                           DefineOpType::ARG : DefineOpType::EXPAND_ARG);
 
-CPrePro::
-CPrePro()
-{
-  output_stream_ = &std::cout;
+      ops.push_back(DefineOp(type, 0, 0, i, paste));
 
-  expr_ = new CExpr;
+      if (type == DefineOpType::EXPAND_ARG)
+        ++define->expand_counts[i];
 
-  expr_->setQuiet(true);
+      paste = false;
 
-  expr_->addFunction("defined", "nis", new DefinedFunction(this));
+      continue;
+    }
 
-  context_stack_.clear();
+    if (paste || ops.empty() || ops.back().type != DefineOpType::TOKENS)
+      ops.push_back(DefineOp(DefineOpType::TOKENS, pos, pos + 1, -1, paste));
+    else
+      ops.back().end = pos + 1;
 
-#ifdef CPRE_PRO_STD_DIRS
-  std::string paths_str = XSTR(CPRE_PRO_STD_DIRS);
+    paste = false;
+  }
+}
 
-  std::vector<std::string> paths;
+void
+CPrePro::
+remove_define(const std::string &name)
+{
+  Define *define = get_define(name);
 
-  CStrUtil::addWords(paths_str, paths);
+  if (! define)
+    return;
 
-  for (auto &path : paths)
-    add_include_dir(path, true);
-#endif
+  define->atom->define = nullptr;
+
+  if (! define->baseline)
+    define_pool_.destroy(define);
 }
 
+// check if token is a define name (__has_include is treated as defined so it can
+// be tested for with #ifdef)
+bool
 CPrePro::
-~CPrePro()
+is_defined(const Token &token)
 {
-  delete expr_;
+  if (token.str == "__has_include")
+    return true;
+
+  return (get_define(token) != nullptr);
 }
 
-void
+CPrePro::Define *
 CPrePro::
-initialize()
+get_define(const std::string &name)
 {
-  start_context(true);
+  return get_define(name.c_str(), int(name.size()));
 }
 
-void
+CPrePro::Define *
 CPrePro::
-process_args(int argc, char **argv)
+get_define(const char *name, int len)
 {
-  for (int i = 1; i < argc; i++) {
-    if (argv[i][0] == '-') {
-      if (argv[i][1] != '\0')
-        process_option(&argv[i][1], i, argv);
-    }
-    else
-      process_arg(argv[i]);
-  }
+  Atom *atom = atoms_.find(name, len, hashName(name, len));
+
+  return (atom ? atom->define : nullptr);
 }
 
-void
+// interned identifier tokens use their atom's define directly
+CPrePro::Define *
 CPrePro::
-process_option(const std::string &option, int &argc, char **argv)
+get_define(const Token &token)
 {
-  if      (option[0] == 'D')
-    add_define_option(option.substr(1));
-  else if (option[0] == 'I')
-    add_include_option(option.substr(1));
-  else if (option[0] == 'o') {
-    ++argc;
-
-    output_file_ = argv[argc];
+  if (token.atom)
+    return token.atom->define;
 
-    output_fstream_ = std::ofstream(output_file_, std::ofstream::out);
+  return get_define(token.str.data(), int(token.str.size()));
+}
 
-    output_stream_ = &output_fstream_;
-  }
-  else if (option == "stdin")
-    add_file(nullptr);
-  else if (option == "no_blank_lines")
-    no_blank_lines_ = true;
-  else if (option == "echo")
-    echo_input_ = true;
-  else if (option == "nostd" || option == "no_std")
-    no_std_ = true;
-  else if (option == "quiet")
-    quiet_ = true;
-  else if (option == "nowarn" || option == "no_warn")
-    warn_ = false;
-  else if (option == "debug")
-    debug_ = true;
-  else if (option == "list_includes")
-    list_includes_ = true;
-  else
-    std::cerr << "Invalid Option " << option << "\n";
+CPrePro::Atom *
+CPrePro::
+intern(const char *name, int len)
+{
+  return atoms_.intern(name, len, hashName(name, len));
 }
 
+// intern identifier tokens from start so define lookups and parameter matching
+// are pointer compares (define values only)
 void
 CPrePro::
-add_define_option(const std::string &name)
+intern_tokens(Tokens &tokens, int start)
 {
-  std::string::size_type p = name.find('=');
-
-  VariableList variables;
+  int len = int(tokens.size());
 
-  if (p != std::string::npos) {
-    std::string name1  = name.substr(0, p);
-    std::string value1 = name.substr(p + 1);
+  for (int pos = start; pos < len; ++pos) {
+    Token &token = tokens[pos];
 
-    add_define(name1, variables, value1);
+    if (token.type == TokenType::IDENTIFIER && ! token.atom)
+      token.atom = intern(token.str.data(), int(token.str.size()));
   }
-  else
-    add_define(name, variables, "1");
 }
 
-void
+// existing atom (or empty atom if not interned) so input identifiers which are
+// not define names or values do not grow the atom table
+CPrePro::Atom *
 CPrePro::
-add_include_option(const std::string &str)
+lookup(const char *name, int len)
 {
-  add_include_dir(str);
+  return atoms_.lookup(name, len, hashName(name, len));
 }
 
+// set atoms of identifier tokens from start (see lookup)
 void
 CPrePro::
-process_arg(const std::string &arg)
+lookup_tokens(Tokens &tokens, int start)
 {
-  add_file(arg);
+  int len = int(tokens.size());
+
+  for (int pos = start; pos < len; ++pos) {
+    Token &token = tokens[pos];
+
+    if (token.type == TokenType::IDENTIFIER && ! token.atom)
+      token.atom = lookup(token.str.data(), int(token.str.size()));
+  }
 }
 
-void
+uint
 CPrePro::
-process_files()
+hashName(const char *name, int len)
 {
-  int num_files = int(files_.size());
+  // FNV-1a
+  uint hash = 2166136261u;
 
-  if (num_files == 0)
-    add_file("");
+  for (int i = 0; i < len; ++i) {
+    hash ^= uint(name[i] & 0xff);
+    hash *= 16777619u;
+  }
 
-  for (int i = 0; i < num_files; i++)
-    process_file(files_[i]);
+  return hash;
 }
 
-void
-CPrePro::
-process_file(const std::string &fileName)
+//------
+
+CPrePro::FileData::
+~FileData()
 {
-  std::string save_current_file = current_file_;
-  uint        save_current_line = current_line_;
+  if (mapped_)
+    munmap(const_cast<char *>(data_), size_);
+}
 
-  if (fileName != "")
-    current_file_ = fileName;
-  else
-    current_file_ = "<stdin>";
+// check file is unchanged since opened (same inode, size and modification time).
+// A modification time too close to the open time is not trusted.
+bool
+CPrePro::FileData::
+isCurrent(const std::string &fileName) const
+{
+  struct stat st;
 
-  current_line_ = 0;
+  if (stat(fileName.c_str(), &st) != 0)
+    return false;
 
-  if (debug_)
-    std::cerr << "Processing file " << current_file_ << "\n";
+  return (uint64_t(st.st_dev) == dev_ && uint64_t(st.st_ino) == ino_ &&
+          size_t(st.st_size) == size_ && statMTime(st) == mtime_ &&
+          mtime_ <= open_time_ - racy_time);
+}
 
-  std::vector<std::string> lines;
+bool
+CPrePro::FileData::
+open(const std::string &fileName)
+{
+  int fd = ::open(fileName.c_str(), O_RDONLY);
 
-  if (fileName != "") {
-    CFile file(fileName);
+  if (fd < 0)
+    return false;
 
-    file.toLines(lines);
-  }
-  else {
-    CFile file(stdin);
+  struct stat st;
 
-    file.toLines(lines);
+  if (fstat(fd, &st) != 0 || ! S_ISREG(st.st_mode)) {
+    ::close(fd);
+    return false;
   }
 
-  std::string line1 = "";
+  size_      = size_t(st.st_size);
+  dev_       = uint64_t(st.st_dev);
+  ino_       = uint64_t(st.st_ino);
+  mtime_     = statMTime(st);
+  open_time_ = currentTime();
 
-  int num_lines = int(lines.size());
+  if (size_ > 0) {
+    void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
 
-  for (int i = 0; i < num_lines; ++i) {
-    std::string line2 = replace_trigraphs(lines[i]);
+    if (data != MAP_FAILED) {
+      madvise(data, size_, MADV_SEQUENTIAL);
 
-    int len = int(line2.size());
+      data_   = static_cast<const char *>(data);
+      mapped_ = true;
+    }
+    else {
+      // fallback to read into buffer
+      buffer_.resize(size_);
 
-    if (len > 0 && line2[len - 1] == '\\') {
-      if (echo_input_)
-        std::cerr << line2 << "\n";
+      size_t size = 0;
 
-      std::string line3 = line2.substr(0, len - 1);
+      while (size < size_) {
+        ssize_t n = ::read(fd, &buffer_[size], size_ - size);
 
-      ++i;
+        if (n <= 0)
+          break;
 
-      line2 = replace_trigraphs(lines[i]);
+        size += size_t(n);
+      }
 
-      len = int(line2.size());
+      size_ = size;
+      data_ = buffer_.data();
+    }
+  }
 
-      while (i < num_lines && len > 0 && line2[len - 1] == '\\') {
-        if (echo_input_)
-          std::cerr << line2 << "\n";
+  ::close(fd);
 
-        line3 += line2.substr(0, len - 1);
+  return true;
+}
 
-        ++i;
+//------
 
-        line2 = replace_trigraphs(lines[i]);
+const char *
+CPrePro::TextBuffer::
+add(const char *str, int len)
+{
+  static const uint block_size = 65536;
 
-        len = int(line2.size());
-      }
+  if (block_ < blocks_.size() && pos_ + uint(len) > blocks_[block_].size()) {
+    ++block_;
 
-      if (i < num_lines) {
-        if (echo_input_)
-          std::cerr << line2 << "\n";
+    pos_ = 0;
+  }
 
-        line3 += line2;
-      }
-      else
-        i--;
+  // add new block (or replace reused block which is too small)
+  if      (block_ >= blocks_.size())
+    blocks_.push_back(std::vector<char>(std::max(block_size, uint(len))));
+  else if (uint(len) > blocks_[block_].size())
+    blocks_[block_].resize(len);
 
-      current_line_ = i + 1;
+  char *str1 = &blocks_[block_][pos_];
 
-      if (! in_comment_ && line3[0] == '#')
-        process_line(line3);
-      else
-        output_line(line3);
-    }
-    else {
-      current_line_ = i + 1;
+  memcpy(str1, str, len);
 
-      if (echo_input_)
-        std::cerr << line2 << "\n";
+  pos_ += len;
 
-      if (! in_comment_ && line2[0] == '#')
-        process_line(line2);
-      else
-        output_line(line2);
+  return str1;
+}
+
+//------
+
+// buffer is allocated on first write to the file descriptor (not used when output
+// is added to a string)
+CPrePro::OutputBuffer::
+OutputBuffer()
+{
+}
+
+CPrePro::OutputBuffer::
+~OutputBuffer()
+{
+  flush();
+
+  if (background_) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+
+      done_ = true;
     }
+
+    cond_.notify_all();
+
+    thread_.join();
   }
 
-  current_file_ = save_current_file;
-  current_line_ = save_current_line;
+  if (fd_ > 2)
+    ::close(fd_);
 }
 
+// set output file descriptor (closed when replaced or on destruction)
 void
-CPrePro::
-process_line(const std::string &line)
+CPrePro::OutputBuffer::
+setFd(int fd)
 {
-  static std::string command;
+  flush();
 
-  std::string line1 = remove_comments(line, true);
+  if (fd_ > 2)
+    ::close(fd_);
 
-  int pos = 1;
+  fd_ = fd;
+}
 
-  CStrUtil::skipSpace(line1, &pos);
+// set string to append output to (null to write to file descriptor)
+void
+CPrePro::OutputBuffer::
+setString(std::string *str)
+{
+  flush();
 
-  int pos1 = pos;
+  str_ = str;
+}
 
-  CStrUtil::skipNonSpace(line1, &pos);
+// write full buffers in background thread
+void
+CPrePro::OutputBuffer::
+setBackground(bool b)
+{
+  if (b == background_ || ! b)
+    return;
 
-  command = line1.substr(pos1, pos - pos1);
+  write_buffer_.resize(buffer_size);
 
-  CStrUtil::skipSpace(line1, &pos);
+  background_ = true;
 
-  if (command != "")
-    process_command(command, line1.substr(pos));
+  thread_ = std::thread(&OutputBuffer::writeThread, this);
 }
 
+// write all buffered output (and wait for background write to complete)
 void
-CPrePro::
-process_command(const std::string &command, const std::string &data)
+CPrePro::OutputBuffer::
+flush()
 {
-  if      (command == "if"     )
-    process_if_command     (data);
-  else if (command == "ifdef"  )
-    process_ifdef_command  (data);
-  else if (command == "ifndef" )
-    process_ifndef_command (data);
-  else if (command == "else"   )
-    process_else_command   (data);
-  else if (command == "elif"   )
-    process_elif_command   (data);
-  else if (command == "endif"  )
-    process_endif_command  (data);
-  else if (command == "define" )
-    process_define_command (data);
-  else if (command == "undef"  )
-    process_undef_command  (data);
-  else if (command == "include")
-    process_include_command(data);
-  else if (command == "error"  )
-    process_error_command  (data);
-  else if (command == "warning")
-    process_warning_command(data);
-  else if (command == "pragma" )
-    ;
-  else
-    std::cerr << "Command '" << command << "' not supported - " <<
-                 current_file_ << ":" << current_line_ << "\n";
+  flushBuffer();
+
+  if (background_) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    cond_.wait(lock, [&]() { return ! pending_; });
+  }
 }
 
+// add text larger than space in buffer
 void
-CPrePro::
-process_if_command(const std::string &data)
+CPrePro::OutputBuffer::
+writeLarge(const char *str, size_t len)
 {
-  start_context(false);
+  if (buffer_.empty())
+    buffer_.resize(buffer_size);
 
-  if (context_->active)
-    context_->processing = process_expression(data);
-  else
-    context_->processing = false;
+  while (len > 0) {
+    size_t n = std::min(len, buffer_.size() - pos_);
 
-  context_->processed = context_->processing;
+    memcpy(&buffer_[pos_], str, n);
+
+    pos_ += n;
+    str  += n;
+    len  -= n;
+
+    if (pos_ == buffer_.size())
+      flushBuffer();
+  }
 }
 
+// write buffer (or pass to background thread when previous write is complete)
 void
-CPrePro::
-process_ifdef_command(const std::string &data)
+CPrePro::OutputBuffer::
+flushBuffer()
 {
-  start_context(false);
+  if (pos_ == 0)
+    return;
 
-  if (context_->active) {
-    Define *define = get_define(data);
+  if (! background_) {
+    writeData(buffer_.data(), pos_);
 
-    context_->processing = (define != nullptr);
+    pos_ = 0;
+
+    return;
   }
-  else
-    context_->processing = false;
 
-  context_->processed = context_->processing;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    cond_.wait(lock, [&]() { return ! pending_; });
+
+    std::swap(buffer_, write_buffer_);
+
+    write_size_ = pos_;
+    pending_    = true;
+  }
+
+  cond_.notify_all();
+
+  pos_ = 0;
 }
 
 void
-CPrePro::
-process_ifndef_command(const std::string &data)
+CPrePro::OutputBuffer::
+writeData(const char *data, size_t len)
 {
-  start_context(false);
+  while (len > 0 && ! failed_) {
+    ssize_t n = ::write(fd_, data, len);
 
-  if (context_->active) {
-    Define *define = get_define(data);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
 
-    context_->processing = (define == nullptr);
-  }
-  else
-    context_->processing = false;
+      std::cerr << "Failed to write output\n";
 
-  context_->processed = context_->processing;
+      failed_ = true;
+
+      break;
+    }
+
+    data += n;
+    len  -= size_t(n);
+  }
 }
 
 void
-CPrePro::
-process_else_command(const std::string &)
+CPrePro::OutputBuffer::
+writeThread()
 {
-  if (context_->active) {
-    context_->processing = ! context_->processed;
+  std::unique_lock<std::mutex> lock(mutex_);
 
-    context_->processed = true;
+  while (true) {
+    cond_.wait(lock, [&]() { return pending_ || done_; });
+
+    if (! pending_)
+      break;
+
+    lock.unlock();
+
+    writeData(write_buffer_.data(), write_size_);
+
+    lock.lock();
+
+    pending_ = false;
+
+    cond_.notify_all();
   }
-  else
-    context_->processing = false;
 }
 
-void
-CPrePro::
-process_elif_command(const std::string &data)
+//------
+
+CPrePro::Stats &
+CPrePro::Stats::
+operator+=(const Stats &stats)
+{
+  include_cache_hits   += stats.include_cache_hits;
+  include_cache_misses += stats.include_cache_misses;
+  dir_cache_reads      += stats.dir_cache_reads;
+  dir_cache_hits       += stats.dir_cache_hits;
+  dir_cache_misses     += stats.dir_cache_misses;
+  includes_skipped     += stats.includes_skipped;
+  lines_skipped        += stats.lines_skipped;
+  files_read           += stats.files_read;
+  defines_added        += stats.defines_added;
+  defines_expanded     += stats.defines_expanded;
+  max_expand_depth      = std::max(max_expand_depth, stats.max_expand_depth);
+  bytes_in             += stats.bytes_in;
+  bytes_out            += stats.bytes_out;
+  objects_allocated    += stats.objects_allocated;
+  objects_reused       += stats.objects_reused;
+  pool_blocks          += stats.pool_blocks;
+  result_cache_hits    += stats.result_cache_hits;
+  result_cache_misses  += stats.result_cache_misses;
+  result_cache_evicted += stats.result_cache_evicted;
+
+  for (int i = 0; i < int(Phase::NUM_PHASES); ++i) {
+    phases[i].count += stats.phases[i].count;
+    phases[i].time  += stats.phases[i].time;
+  }
+
+  return *this;
+}
+
+//------
+
+const std::string &
+CPrePro::Define::
+name() const
 {
-  if (context_->active) {
-    bool flag = process_expression(data);
+  return atom->name;
+}
 
-    if (flag)
-      context_->processing = ! context_->processed;
+//------
 
-    if (context_->processing)
-      context_->processed = true;
-  }
-  else
-    context_->processing = false;
+CPrePro::AtomTable::
+AtomTable()
+{
+  rehash(1024);
 }
 
 void
-CPrePro::
-process_endif_command(const std::string &)
+CPrePro::AtomTable::
+getDefines(std::vector<Define *> &defines) const
 {
-  if (! end_context())
-    std::cerr << "if/endif mismatch - " <<
-                 current_file_ << ":" << current_line_ << "\n";
+  for (const auto &slot : slots_)
+    if (slot.atom && slot.atom->define)
+      defines.push_back(slot.atom->define);
 }
 
 void
-CPrePro::
-process_define_command(const std::string &data)
+CPrePro::AtomTable::
+clearDefines()
 {
-  if (! context_->active || ! context_->processing)
-    return;
-
-  int pos = 0;
-  int len = int(data.size());
+  for (const auto &slot : slots_)
+    if (slot.atom)
+      slot.atom->define = nullptr;
+}
 
-  CStrUtil::skipSpace(data, &pos);
+CPrePro::Atom *
+CPrePro::AtomTable::
+find(const char *name, int len, uint hash) const
+{
+  uint i = hash & mask_;
 
-  int pos1 = pos;
+  while (true) {
+    const Slot &slot = slots_[i];
 
-  if (pos < len && (isalpha(data[pos]) || data[pos] == '_')) {
-    ++pos;
+    if (! slot.atom)
+      return nullptr;
 
-    while (pos < len && (isalnum(data[pos]) || data[pos] == '_'))
-      ++pos;
-  }
+    if (slot.hash == hash && int(slot.atom->name.size()) == len &&
+        memcmp(slot.atom->name.c_str(), name, len) == 0)
+      return slot.atom;
 
-  if (pos == pos1) {
-    std::cerr << "Invalid define '" << data << "' - " <<
-                 current_file_ << ":" << current_line_ << "\n";
-    return;
+    i = (i + 1) & mask_;
   }
+}
 
-  std::string name = data.substr(pos1, pos - pos1);
-
-  VariableList variables;
-
-  if (pos < len && data[pos] == '(') {
-    ++pos;
-
-    CStrUtil::skipSpace(data, &pos);
+CPrePro::Atom *
+CPrePro::AtomTable::
+lookup(const char *name, int len, uint hash)
+{
+  Atom *atom = find(name, len, hash);
 
-    if (pos < len && data[pos] != ')') {
-      pos1 = pos;
+  return (atom ? atom : &none_);
+}
 
-      if (pos < len && (isalpha(data[pos]) || data[pos] == '_')) {
-        ++pos;
+CPrePro::Atom *
+CPrePro::AtomTable::
+intern(const char *name, int len, uint hash)
+{
+  // keep load under 1/2 so probe chains stay short
+  uint num_slots = uint(slots_.size());
 
-        while (pos < len && (isalnum(data[pos]) || data[pos] == '_'))
-          ++pos;
-      }
+  if (2*uint(atoms_.size() + 1) > num_slots)
+    rehash(2*num_slots);
 
-      if (pos == pos1) {
-        std::cerr << "Invalid define '" << data << "' - " <<
-                     current_file_ << ":" << current_line_ << "\n";
-        return;
-      }
+  uint i = hash & mask_;
 
-      std::string variable = data.substr(pos1, pos - pos1);
+  while (slots_[i].atom) {
+    Atom *atom = slots_[i].atom;
 
-      variables.push_back(variable);
+    if (slots_[i].hash == hash && int(atom->name.size()) == len &&
+        memcmp(atom->name.c_str(), name, len) == 0)
+      return atom;
 
-      CStrUtil::skipSpace(data, &pos);
+    i = (i + 1) & mask_;
+  }
 
-      while (pos < len && data[pos] == ',') {
-        ++pos;
+  Atom *atom = pool_.create(name, len, hash);
 
-        CStrUtil::skipSpace(data, &pos);
+  slots_[i].hash = hash;
+  slots_[i].atom = atom;
 
-        pos1 = pos;
+  atoms_.push_back(atom);
 
-        if (pos < len && (isalpha(data[pos]) || data[pos] == '_')) {
-          ++pos;
+  return atom;
+}
 
-          while (pos < len && (isalnum(data[pos]) || data[pos] == '_'))
-            ++pos;
-        }
+void
+CPrePro::AtomTable::
+truncate(int size)
+{
+  if (size >= int(atoms_.size()))
+    return;
 
-        if (pos == pos1) {
-          std::cerr << "Invalid define '" << data << "' - " <<
-                       current_file_ << ":" << current_line_ << "\n";
-          return;
-        }
+  for (size_t i = size; i < atoms_.size(); ++i)
+    pool_.destroy(atoms_[i]);
 
-        std::string variable1 = data.substr(pos1, pos - pos1);
+  atoms_.resize(size);
 
-        variables.push_back(variable1);
+  // reinsert remaining atoms
+  for (auto &slot : slots_)
+    slot = Slot();
 
-        CStrUtil::skipSpace(data, &pos);
-      }
-    }
+  for (const auto &atom : atoms_) {
+    uint i = atom->hash & mask_;
 
-    if (pos >= len || data[pos] != ')') {
-      std::cerr << "Invalid define '" << data << "' - " <<
-                   current_file_ << ":" << current_line_ << "\n";
-      return;
-    }
+    while (slots_[i].atom)
+      i = (i + 1) & mask_;
 
-    ++pos;
+    slots_[i].hash = atom->hash;
+    slots_[i].atom = atom;
   }
-
-  CStrUtil::skipSpace(data, &pos);
-
-  std::string value = CStrUtil::stripSpaces(data.substr(pos));
-
-  if (value == "")
-    value = "1";
-
-  add_define(name, variables, value);
 }
 
 void
-CPrePro::
-process_undef_command(const std::string &data)
+CPrePro::AtomTable::
+rehash(uint num_slots)
 {
-  if (! context_->active || ! context_->processing)
-    return;
+  Slots slots(num_slots);
 
-  int pos = 0;
+  std::swap(slots_, slots);
 
-  CStrUtil::skipSpace(data, &pos);
+  mask_ = num_slots - 1;
 
-  int pos1 = pos;
+  for (const auto &slot : slots) {
+    if (! slot.atom)
+      continue;
 
-  CStrUtil::skipNonSpace(data, &pos);
+    uint i = slot.hash & mask_;
 
-  std::string name = data.substr(pos1, pos - pos1);
+    while (slots_[i].atom)
+      i = (i + 1) & mask_;
 
-  remove_define(name);
+    slots_[i] = slot;
+  }
 }
 
 void
 CPrePro::
-process_include_command(const std::string &data)
+add_include_dir(const std::string &dirName, bool std)
 {
-  if (! context_->active || ! context_->processing)
-    return;
-
-  std::string data1 = replace_defines(data, true);
+  if (std)
+    std_include_dirs_.push_back(dirName);
+  else
+    include_dirs_.push_back(dirName);
+}
 
-  int len = int(data1.size());
+// resolve include file name (cached on quote/angle, including directory for quoted
+// include, and name)
+CPrePro::IncludeFile
+CPrePro::
+get_include_file(const std::string &fileName, bool quoted)
+{
+  CPreProPhaseTimer timer(this, Phase::INCLUDE);
 
-  if (len < 2) {
-    std::cerr << "Illegal include syntax - " <<
-                 current_file_ << ":" << current_line_ << "\n";
-    return;
-  }
+  std::string current_dir;
 
-  char c;
+  if (quoted) {
+    std::string::size_type p = current_path_.rfind('/');
 
-  if      (data1[0] == '\"')
-    c = '\"';
-  else if (data1[0] == '<')
-    c = '>';
-  else {
-    std::cerr << "Illegal include syntax - " <<
-                 current_file_ << ":" << current_line_ << "\n";
-    return;
+    if (p != std::string::npos)
+      current_dir = current_path_.substr(0, p);
   }
 
-  int i = 1;
+  std::string key = (quoted ? "\"" + current_dir + "\"" : "<") + fileName;
 
-  for (i = 1; i < len && data1[i] != c; ++i)
-    ;
+  IncludeCache &include_cache = shared_->include_cache;
 
-  std::string fileName = data1.substr(1, i - 1);
+  {
+    std::unique_lock<std::mutex> lock(shared_->mutex);
 
-  bool std = false;
+    auto pi = include_cache.find(key);
 
-  const std::string include_file = get_include_file(fileName, std);
+    if (pi != include_cache.end()) {
+      ++stats_data_.include_cache_hits;
 
-  if (include_file == "") {
-    if (warn_)
-      std::cerr << "Failed to find include file '" << fileName << "' - " <<
-                   current_file_ << ":" << current_line_ << "\n";
-    return;
+      if (cache_record_)
+        add_cache_lookup(fileName, current_dir, (*pi).second.file);
+
+      return (*pi).second;
+    }
   }
 
-  if (std && no_std_)
-    return;
+  ++stats_data_.include_cache_misses;
 
-  Include *include = new Include(include_file);
+  // search without lock (another worker may add the same result)
+  IncludeFile include_file;
 
-  if (! current_include_)
-    current_include_ = new Include("");
+  include_file.file = find_include_file(fileName, current_dir, include_file.std);
 
-  current_include_->includes.push_back(include);
+  if (include_file.file != "")
+    include_file.key = file_key(include_file.file);
 
-  std::swap(current_include_, include);
+  std::unique_lock<std::mutex> lock(shared_->mutex);
 
-  process_file(current_include_->filename);
+  include_cache.emplace(key, include_file);
 
-  std::swap(current_include_, include);
+  if (cache_record_)
+    add_cache_lookup(fileName, current_dir, include_file.file);
+
+  return include_file;
 }
 
-void
+// key identifying a file for include guards and #pragma once. The real path is
+// used so a file reached by different paths (../a.h, ./a.h, symbolic link) has
+// one key
+std::string
 CPrePro::
-process_error_command(const std::string &data)
+file_key(const std::string &fileName) const
 {
-  if (! context_->active || ! context_->processing)
-    return;
+  char *path = realpath(fileName.c_str(), nullptr);
 
-  std::cerr << data << " - " << current_file_ << ":" << current_line_ << "\n";
-}
+  if (! path)
+    return fileName;
 
-void
-CPrePro::
-process_warning_command(const std::string &data)
-{
-  if (! context_->active || ! context_->processing)
-    return;
+  std::string key(path);
 
-  std::cerr << data << " - " << current_file_ << ":" << current_line_ << "\n";
+  free(path);
+
+  return key;
 }
 
-int
+std::string
 CPrePro::
-process_expression(const std::string &expression)
+find_include_file(const std::string &fileName, const std::string &current_dir, bool &std)
 {
-  std::string expression1 = replace_defines(expression, true);
+  std = false;
 
-  CExprValuePtr value;
+  if (current_dir != "" && fileName[0] != '/') {
+    std::string fileName1 = current_dir + "/" + fileName;
 
-  if (! expr_->evaluateExpression(expression1, value))
-    return false;
+    if (include_file_exists(fileName1))
+      return fileName1;
+  }
+
+  if (include_file_exists(fileName))
+    return fileName;
 
-  long integer;
+  for (const auto &dir : include_dirs_) {
+    std::string fileName1 = dir + "/" + fileName;
 
-  if (! value || ! value->getIntegerValue(integer))
-    return false;
+    if (include_file_exists(fileName1))
+      return fileName1;
+  }
+
+  std = true;
+
+  for (const auto &dir : std_include_dirs_) {
+    std::string fileName1 = dir + "/" + fileName;
+
+    if (include_file_exists(fileName1))
+      return fileName1;
+  }
+
+  std::string fileName1 = "/usr/include/" + fileName;
 
-  return (integer != 0);
+  if (include_file_exists(fileName1))
+    return fileName1;
+
+  return "";
 }
 
-void
+// check if file exists (using cached directory listing if enabled)
+bool
 CPrePro::
-output_line(const std::string &line)
+include_file_exists(const std::string &fileName)
 {
-  if (! context_->active || ! context_->processing)
-    return;
+  std::string dirName, baseName;
 
-  if (quiet_)
-    return;
+  std::string::size_type p = fileName.rfind('/');
+
+  if (p != std::string::npos) {
+    dirName  = (p > 0 ? fileName.substr(0, p) : "/");
+    baseName = fileName.substr(p + 1);
+  }
+  else {
+    dirName  = ".";
+    baseName = fileName;
+  }
 
-  std::string line1 = remove_comments(line, false);
+  add_dir_stamp(dirName);
 
-  std::string line2 = replace_defines(line1, false);
+  if (! dir_cache_)
+    return CFile::exists(fileName);
 
-  if (no_blank_lines_) {
-    int len = int(line2.size());
-    int pos = 0;
+  DirCache &dir_files = shared_->dir_files;
 
-    CStrUtil::skipSpace(line2, &pos);
+  bool found;
 
-    if (pos >= len) return;
-  }
+  {
+    std::unique_lock<std::mutex> lock(shared_->mutex);
 
-  (*output_stream_) << line2 << "\n";
-}
+    auto pd = dir_files.find(dirName);
 
-std::string
-CPrePro::
-replace_trigraphs(const std::string &line)
-{
-  static const char trigraph_chars1[] = "=/\'()!<>-";
-  static const char trigraph_chars2[] = "#\\^[]|{}~";
+    if (pd != dir_files.end())
+      found = ((*pd).second.find(baseName) != (*pd).second.end());
+    else {
+      lock.unlock();
 
-  std::string line1;
+      // read directory without lock (another worker may add the same listing)
+      ++stats_data_.dir_cache_reads;
 
-  int len = int(line.size());
+      DirFiles files;
+
+      DIR *dir = opendir(dirName.c_str());
 
-  int j = 0;
+      if (dir) {
+        struct dirent *entry;
 
-  for (int i = 0; i < int(len) - 2; ++i) {
-    if (line[i] != '?' || line[i + 1] != '?') continue;
+        while ((entry = readdir(dir)) != nullptr)
+          files.insert(entry->d_name);
 
-    const char *p = strchr(trigraph_chars1, line[i + 2]);
-    if (! p) continue;
+        closedir(dir);
+      }
+
+      found = (files.find(baseName) != files.end());
 
-    line1 += line.substr(j, i - j);
-    line1 += trigraph_chars2[p - trigraph_chars1];
+      lock.lock();
 
-    i += 3;
+      dir_files.emplace(dirName, std::move(files));
+    }
+  }
 
-    j = i;
+  if (! found) {
+    ++stats_data_.dir_cache_misses;
+    return false;
   }
 
-  line1 += line.substr(j);
+  ++stats_data_.dir_cache_hits;
 
-  return line1;
+  return true;
 }
 
-std::string
+// record modification time of directory searched for include file (see
+// check_file_caches)
+void
 CPrePro::
-remove_comments(const std::string &line, bool preprocessor_line)
+add_dir_stamp(const std::string &dirName)
 {
-  bool in_comment1;
+  DirStamps &dir_stamps = shared_->dir_stamps;
 
-  if (preprocessor_line)
-    in_comment1 = false;
-  else
-    in_comment1 = in_comment_;
+  {
+    std::unique_lock<std::mutex> lock(shared_->mutex);
 
-  std::string line1;
+    if (dir_stamps.find(dirName) != dir_stamps.end())
+      return;
+  }
 
-  int pos = 0;
-  int len = int(line.size());
+  DirStamp stamp;
 
-  while (pos < len) {
-    if      (! in_comment1 && line[pos] == '/' && line[pos + 1] == '*') {
-      in_comment1 = true;
+  struct stat st;
 
-      pos += 2;
-    }
-    else if (  in_comment1 && line[pos] == '*' && line[pos + 1] == '/') {
-      in_comment1 = false;
+  if (stat(dirName.c_str(), &st) == 0)
+    stamp.mtime = statMTime(st);
 
-      pos += 2;
-    }
-#ifdef CPP_SUPPORT
-    else if (! in_comment1 && line[pos] == '/' && line[pos + 1] == '/') {
-      break;
-    }
-#endif
-    else {
-      if (! in_comment1)
-        line1 += line[pos];
+  stamp.time = currentTime();
 
-      ++pos;
-    }
-  }
+  std::unique_lock<std::mutex> lock(shared_->mutex);
 
-  if (preprocessor_line)
-    in_comment_ = false;
-  else
-    in_comment_ = in_comment1;
+  dir_stamps.emplace(dirName, stamp);
+}
+
+void
+CPrePro::
+destroy_include(Include *include)
+{
+  for (const auto &include1 : include->includes)
+    destroy_include(include1);
 
-  return line1;
+  include_pool_.destroy(include);
 }
 
-std::string
+void
 CPrePro::
-replace_defines(const std::string &tline, bool preprocessor_line)
+start_context(bool processing)
 {
-  if (tline.empty()) return tline;
+  Context *old_context = context_;
+
+  if (old_context)
+    context_stack_.push_back(old_context);
 
-  //------
+  context_ = context_pool_.create();
 
-  struct ReplaceDefineData data;
+  if (old_context)
+    context_->active = old_context->processing;
+  else
+    context_->active = true;
 
-  return replace_defines(tline, preprocessor_line, data);
+  context_->processing = processing;
+  context_->processed  = processing;
 }
 
-std::string
+bool
 CPrePro::
-replace_defines(const std::string &tline, bool preprocessor_line, ReplaceDefineData &data)
+end_context()
 {
-  std::string line = tline;
+  bool flag = true;
 
-  if (data.in_replace_defines > 0) {
-    DefineList used_defines2;
+  context_pool_.destroy(context_);
 
-    for (const auto &pd : used_defines2)
-      used_defines2.push_back(pd);
+  if (! context_stack_.empty()) {
+    context_ = context_stack_.back();
 
-    data.used_defines_list.push_back(used_defines2);
+    context_stack_.pop_back();
   }
   else {
-    data.used_defines.clear();
+    context_ = nullptr;
 
-    data.used_defines_list.clear();
+    flag = false;
   }
 
-  //------
-
-  DefineList used_defines1;
-
-  int num_replaced = 0;
-
-  ++data.in_replace_defines;
-
-  while (data.in_replace_defines > int(data.lines1.size()))
-    data.lines1.push_back(new std::string);
-
-  int iline1 = data.in_replace_defines - 1;
+  if (! context_) {
+    context_ = context_pool_.create();
 
-  *data.lines1[iline1] = "";
+    context_->active     = true;
+    context_->processed  = false;
+    context_->processing = true;
+  }
 
-  ArgList args;
+  return flag;
+}
 
-  int pos = 0;
-  int len = int(line.size());
+void
+CPrePro::
+terminate()
+{
+  if (is_deps())
+    write_dependencies();
 
-  while (pos < len) {
-    int pos1 = pos;
+  output_.flush();
 
-    bool in_string1 = false;
-    bool in_string2 = false;
+  if (list_includes_) {
+    if (current_include_)
+      current_include_->print(std::cout);
+  }
 
-    while (pos < len) {
-      if (! in_string1 && ! in_string2) {
-        if      (isalpha(line[pos]) || line[pos] == '_')
-          break;
-        else if (line[pos] == '\'')
-          in_string1 = ! in_string1;
-        else if (line[pos] == '\"')
-          in_string2 = ! in_string2;
-      }
-      else if (in_string1) {
-        if      (line[pos] == '\\') {
-          if (pos < len - 1)
-            ++pos;
-        }
-        else if (line[pos] == '\'')
-          in_string1 = ! in_string1;
-      }
-      else if (in_string2) {
-        if      (line[pos] == '\\') {
-          if (pos < len - 1)
-            ++pos;
-        }
-        else if (line[pos] == '\"')
-          in_string2 = ! in_string2;
-      }
+  if (save_state_file_ != "")
+    save_state(save_state_file_);
 
-      ++pos;
-    }
+  if (stats_)
+    print_stats(std::cerr);
+}
 
-    if (pos1 != pos)
-      *data.lines1[iline1] += line.substr(pos1, pos - pos1);
+// cache key : file name and contents, options affecting output and the initial
+// defines and include guards
+uint64_t
+CPrePro::
+cache_key(const std::string &fileName, const FileData &file_data)
+{
+  uint64_t hash = hashData(result_cache_magic, sizeof(result_cache_magic), result_cache_version);
 
-    if (pos >= len)
-      break;
+  auto addString = [&](const std::string &str) {
+    hash = hashData(str.c_str(), str.size() + 1, hash);
+  };
 
-    pos1 = pos;
+  addString(fileName);
 
-    if (pos < len)
-      ++pos;
+  hash = hashData(file_data.data(), file_data.size(), hash);
 
-    while (pos < len && (isalnum(line[pos]) || line[pos] == '_'))
-      ++pos;
+  for (const auto &dir : include_dirs_)
+    addString("-I" + dir);
 
-    std::string identifier = line.substr(pos1, pos - pos1);
+  for (const auto &dir : std_include_dirs_)
+    addString("-isystem" + dir);
 
-    if (preprocessor_line && identifier == "defined" &&
-        pos < len && line[pos] == '(') {
-      ++pos;
+  char flags[5] = { no_blank_lines_, no_std_, quiet_, warn_, line_markers_ };
 
-      pos1 = pos;
+  hash = hashData(flags, sizeof(flags), hash);
 
-      while (pos < len && line[pos] != ')')
-        ++pos;
+  std::vector<Define *> defines;
 
-      std::string identifier1 = line.substr(pos1, pos - pos1);
+  atoms_.getDefines(defines);
 
-      if (pos < len && line[pos] == ')')
-        ++pos;
+  std::sort(defines.begin(), defines.end(), [](const Define *d1, const Define *d2) {
+    return d1->name() < d2->name();
+  });
 
-      Define *define = get_define(identifier1);
+  for (const auto &define : defines) {
+    addString(define->name());
 
-      if (define)
-        *data.lines1[iline1] += "1";
-      else
-        *data.lines1[iline1] += "0";
+    if (define->function) {
+      addString("(");
 
-      continue;
+      for (const auto &variable : define->variables)
+        addString(variable);
     }
 
-    Define *define = get_define(identifier);
+    addString(define->value);
+  }
 
-    if (! define) {
-      *data.lines1[iline1] += identifier;
+  std::vector<std::string> guards;
 
-      continue;
-    }
+  for (const auto &pg : file_guards_)
+    guards.push_back(pg.first + (pg.second.once ? "#once" : "#" + pg.second.guard));
 
-    DefineList::const_iterator pd1, pd2;
+  std::sort(guards.begin(), guards.end());
 
-    for (pd1 = data.used_defines.begin(), pd2 = data.used_defines.end(); pd1 != pd2; ++pd1)
-      if ((*pd1) == define)
-        break;
+  for (const auto &guard : guards)
+    addString(guard);
 
-    if (pd1 != pd2) {
-      *data.lines1[iline1] += identifier;
+  return hash;
+}
 
-      continue;
-    }
+// add cached result to output if all files used to create it are unchanged
+bool
+CPrePro::
+read_cache(const std::string &cacheFile)
+{
+  FileData file_data;
 
-    if (define->variables.empty()) {
-      used_defines1.push_back(define);
+  if (! file_data.open(cacheFile))
+    return false;
 
-      *data.lines1[iline1] += define->value;
+  const char *p     = file_data.data();
+  const char *p_end = p + file_data.size();
 
-      num_replaced++;
+  bool ok = true;
 
-      continue;
+  auto readData = [&](void *data, size_t size) {
+    if (! ok || size > size_t(p_end - p)) {
+      ok = false;
+      return;
     }
 
-    pos1 = pos;
+    memcpy(data, p, size);
 
-    CStrUtil::skipSpace(line, &pos1);
+    p += size;
+  };
 
-    if (pos1 < len && line[pos1] != '(') {
-      *data.lines1[iline1] += identifier;
+  auto readInt = [&]() {
+    uint64_t i = 0;
 
-      continue;
+    readData(&i, sizeof(i));
+
+    return i;
+  };
+
+  auto readString = [&](std::string &str) {
+    uint64_t len = readInt();
+
+    if (! ok || len > uint64_t(p_end - p)) {
+      ok = false;
+      return;
     }
 
-    pos = pos1;
+    str.assign(p, len);
 
-    args.clear();
+    p += len;
+  };
 
-    int pos2 = pos;
+  char magic[sizeof(result_cache_magic)];
 
-    ++pos;
+  readData(magic, sizeof(magic));
 
-    while (pos < len) {
-      CStrUtil::skipSpace(line, &pos);
+  if (! ok || memcmp(magic, result_cache_magic, sizeof(magic)) != 0 ||
+      readInt() != result_cache_version)
+    return false;
 
-      pos1 = pos;
+  uint64_t num_files = readInt();
 
-      int  brackets   = 0;
-      bool in_string3 = false;
-      bool in_string4 = false;
+  CacheFile cache_file;
 
-      while (pos < len) {
-        if (! in_string3 && ! in_string4) {
-          if      (line[pos] == '(')
-            ++brackets;
-          else if (line[pos] == ')') {
-            if (brackets <= 0)
-              break;
-
-            --brackets;
-          }
-          else if (line[pos] == ',') {
-            if (brackets <= 0)
-              break;
-          }
-          else if (line[pos] == '\'')
-            in_string3 = ! in_string3;
-          else if (line[pos] == '\"')
-            in_string4 = ! in_string4;
-        }
-        else if (in_string3) {
-          if      (line[pos] == '\\') {
-            if (pos < len - 1)
-              ++pos;
-          }
-          else if (line[pos] == '\'')
-            in_string3 = ! in_string3;
-        }
-        else if (in_string4) {
-          if      (line[pos] == '\\') {
-            if (pos < len - 1)
-              ++pos;
-          }
-          else if (line[pos] == '\"')
-            in_string4 = ! in_string4;
-        }
+  for (uint64_t i = 0; ok && i < num_files; ++i) {
+    readString(cache_file.name);
 
-        ++pos;
-      }
+    cache_file.size  = readInt();
+    cache_file.mtime = int64_t(readInt());
+    cache_file.hash  = readInt();
 
-      std::string arg = line.substr(pos1, pos - pos1);
+    if (! ok)
+      return false;
 
-      arg = CStrUtil::stripSpaces(arg);
+    struct stat st;
 
-      args.push_back(arg);
+    if (stat(cache_file.name.c_str(), &st) != 0 || uint64_t(st.st_size) != cache_file.size)
+      return false;
 
-      if (pos >= len || line[pos] == ')') {
-        if (pos < len)
-          ++pos;
+    // modified (or touched) file is still valid if contents are unchanged
+    int64_t mtime = statMTime(st);
 
-        break;
-      }
+    if (mtime != cache_file.mtime) {
+      FileData file_data1;
 
-      if (pos < len && line[pos] == ',')
-        ++pos;
+      if (! file_data1.open(cache_file.name) ||
+          hashData(file_data1.data(), file_data1.size()) != cache_file.hash)
+        return false;
     }
+  }
 
-    //------
+  // include lookups must resolve to the same file (a header added earlier in the
+  // search path or a missing header which now exists invalidates the result)
+  uint64_t num_lookups = readInt();
 
-    int num_args = int(args.size());
+  CacheLookup cache_lookup;
 
-    int num_variables = int(define->variables.size());
+  for (uint64_t i = 0; ok && i < num_lookups; ++i) {
+    readString(cache_lookup.name);
+    readString(cache_lookup.dir);
+    readString(cache_lookup.file);
 
-    if (num_args != num_variables) {
-      args.clear();
+    if (! ok)
+      return false;
 
-      *data.lines1[iline1] += identifier;
+    bool std;
 
-      pos = pos2;
+    if (find_include_file(cache_lookup.name, cache_lookup.dir, std) != cache_lookup.file)
+      return false;
+  }
 
-      continue;
-    }
+  uint64_t len = readInt();
 
-    bool hash_hash_before = false;
-    bool hash_hash_after  = false;
+  if (! ok || len != uint64_t(p_end - p))
+    return false;
 
-    int len1 = int(define->value.size());
+  {
+    CPreProPhaseTimer timer(this, Phase::OUTPUT);
 
-    pos1 = 0;
+    output_.write(p, len);
+  }
 
-    while (pos1 < len1) {
-      pos2 = pos1;
+  stats_data_.bytes_out += long(len);
 
-      bool hash_before = false;
+  // update modification time for least recently used eviction
+  utimensat(AT_FDCWD, cacheFile.c_str(), nullptr, 0);
 
-      hash_hash_before = false;
+  return true;
+}
 
-      int pos3;
+// write cache file (to temporary file which is renamed so readers never see a
+// partial file)
+bool
+CPrePro::
+write_cache(const std::string &cacheFile, const std::string &output)
+{
+  std::string tempFile = cacheFile + ".tmp" + std::to_string(getpid()) + "_" +
+                         std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
 
-      while (pos1 < len1) {
-        hash_before      = false;
-        hash_hash_before = false;
+  {
+    std::ofstream os(tempFile, std::ofstream::out | std::ofstream::binary);
 
-        if (define->value[pos1] == '#') {
-          pos3 = pos1;
+    if (! os)
+      return false;
 
-          ++pos1;
+    auto writeInt = [&](uint64_t i) {
+      os.write(reinterpret_cast<const char *>(&i), sizeof(i));
+    };
 
-          if (define->value[pos1] == '#') {
-            ++pos1;
+    auto writeString = [&](const std::string &str) {
+      writeInt(str.size());
 
-            hash_hash_before = true;
-          }
-          else
-            hash_before = true;
+      os.write(str.c_str(), str.size());
+    };
 
-          CStrUtil::skipSpace(define->value, &pos1);
-        }
+    os.write(result_cache_magic, sizeof(result_cache_magic));
 
-        if (pos1 < len1 && (isalpha(define->value[pos1]) || define->value[pos1] == '_'))
-          break;
+    writeInt(result_cache_version);
 
-        ++pos1;
-      }
+    writeInt(cache_files_.size());
 
-      if (hash_before) {
-        if (pos3 != pos2)
-          *data.lines1[iline1] += define->value.substr(pos2, pos3 - pos2);
-      }
-      else {
-        if (pos1 != pos2)
-          *data.lines1[iline1] += define->value.substr(pos2, pos1 - pos2);
-      }
+    for (const auto &cache_file : cache_files_) {
+      writeString(cache_file.name);
 
-      if (pos1 >= len1)
-        break;
+      writeInt(cache_file.size);
+      writeInt(uint64_t(cache_file.mtime));
+      writeInt(cache_file.hash);
+    }
 
-      pos2 = pos1;
+    writeInt(cache_lookups_.size());
 
-      ++pos1;
+    for (const auto &cache_lookup : cache_lookups_) {
+      writeString(cache_lookup.name);
+      writeString(cache_lookup.dir);
+      writeString(cache_lookup.file);
+    }
 
-      while (pos < len1 && (isalnum(define->value[pos1]) || define->value[pos1] == '_'))
-        ++pos1;
+    writeString(output);
 
-      std::string identifier1 = define->value.substr(pos2, pos1 - pos2);
+    if (! os) {
+      os.close();
 
-      int i = 0;
+      unlink(tempFile.c_str());
 
-      for (i = 0; i < num_variables; i++)
-        if (define->variables[i] == identifier1)
-          break;
+      return false;
+    }
+  }
 
-      if (i >= num_variables) {
-        *data.lines1[iline1] += define->value.substr(pos2, pos1 - pos2);
+  if (rename(tempFile.c_str(), cacheFile.c_str()) != 0) {
+    unlink(tempFile.c_str());
+    return false;
+  }
 
-        continue;
-      }
+  return true;
+}
 
-      pos2 = pos1;
+// remove least recently used cache files until cache is under 3/4 of size limit
+void
+CPrePro::
+evict_cache()
+{
+  struct CacheEntry {
+    std::string name;
+    long        size  { 0 };
+    int64_t     mtime { 0 };
+  };
 
-      CStrUtil::skipSpace(define->value, &pos2);
+  std::vector<CacheEntry> entries;
 
-      if (pos2 < len1 - 1 && define->value[pos2] == '#' && define->value[pos2 + 1] == '#')
-        hash_hash_after = true;
-      else
-        hash_hash_after = false;
+  long total_size = 0;
 
-      if (hash_before) {
-        *data.lines1[iline1] += "\"";
+  DIR *dir = opendir(cache_dir_.c_str());
 
-        pos2 = 0;
-        len1 = int(args[i].size());
+  if (! dir)
+    return;
 
-        while (pos2 < len1) {
-          if (args[i][pos2] == '"' || args[i][pos2] == '\\')
-            *data.lines1[iline1] += "\\";
+  struct dirent *entry;
 
-          *data.lines1[iline1] += args[i][pos2];
+  while ((entry = readdir(dir)) != nullptr) {
+    std::string name = entry->d_name;
 
-          ++pos2;
-        }
+    int len = int(name.size());
 
-        *data.lines1[iline1] += "\"";
-      }
-      else {
-        std::string args1;
+    if (len < 5 || name.compare(len - 5, 5, ".cppc") != 0)
+      continue;
 
-        if (! hash_hash_before && ! hash_hash_after)
-          args1 = replace_defines(args[i], false);
-        else
-          args1 = args[i];
+    CacheEntry cache_entry;
 
-        *data.lines1[iline1] += args1;
-      }
+    cache_entry.name = cache_dir_ + "/" + name;
 
-      ++num_replaced;
-    }
+    struct stat st;
 
-    used_defines1.push_back(define);
+    if (stat(cache_entry.name.c_str(), &st) != 0)
+      continue;
+
+    cache_entry.size  = long(st.st_size);
+    cache_entry.mtime = statMTime(st);
 
-    args.clear();
+    total_size += cache_entry.size;
 
-    *data.lines1[iline1] = replace_hash_hash(*data.lines1[iline1]);
+    entries.push_back(cache_entry);
   }
 
-  std::string line2;
+  closedir(dir);
+
+  if (total_size <= cache_size_)
+    return;
+
+  std::sort(entries.begin(), entries.end(), [](const CacheEntry &e1, const CacheEntry &e2) {
+    return e1.mtime < e2.mtime;
+  });
+
+  for (const auto &cache_entry : entries) {
+    if (total_size <= cache_size_*3/4)
+      break;
 
-  if (num_replaced > 0) {
-    for (const auto &pd : used_defines1)
-      data.used_defines.push_back(pd);
+    if (unlink(cache_entry.name.c_str()) == 0)
+      ++stats_data_.result_cache_evicted;
 
-    line2 = replace_defines(*data.lines1[iline1], false, data);
+    total_size -= cache_entry.size;
   }
-  else
-    line2 = *data.lines1[iline1];
+}
 
-  used_defines1.clear();
+// add file read while processing to files validated for cache hit
+void
+CPrePro::
+add_cache_file(const std::string &fileName, const FileData &file_data)
+{
+  if (! cache_file_set_.insert(fileName).second)
+    return;
 
-  *data.lines1[data.in_replace_defines - 1] = *data.lines1[iline1];
+  struct stat st;
 
-  --data.in_replace_defines;
+  if (stat(fileName.c_str(), &st) != 0)
+    return;
 
-  data.used_defines.clear();
+  CacheFile cache_file;
 
-  if (data.in_replace_defines > 0)
-    data.used_defines_list.pop_back();
+  cache_file.name  = fileName;
+  cache_file.size  = file_data.size();
+  cache_file.mtime = statMTime(st);
+  cache_file.hash  = hashData(file_data.data(), file_data.size());
 
-  return line2;
+  cache_files_.push_back(cache_file);
 }
 
-std::string
+// add include lookup made while processing to lookups validated for cache hit
+void
 CPrePro::
-replace_hash_hash(const std::string &tline)
+add_cache_lookup(const std::string &name, const std::string &dir, const std::string &file)
 {
-  std::string line = tline;
+  if (! cache_lookup_set_.insert(dir + "\"" + name).second)
+    return;
 
-  std::string line1;
+  CacheLookup cache_lookup;
 
-  int len = int(line.size());
+  cache_lookup.name = name;
+  cache_lookup.dir  = dir;
+  cache_lookup.file = file;
 
-  int i = 0;
+  cache_lookups_.push_back(cache_lookup);
+}
 
-  while (i < len) {
-    int i1 = i;
+// 64 bit hash of data (8 byte words with multiply/xor-shift mixing)
+uint64_t
+CPrePro::
+hashData(const char *data, size_t len, uint64_t hash)
+{
+  const uint64_t prime = 0x9e3779b97f4a7c15ULL;
 
-    CStrUtil::skipSpace(line, &i1);
+  hash ^= len*prime;
 
-    if (i1 < len - 1 && line[i1] == '#' && line[i1 + 1] == '#') {
-      i1 += 2;
+  size_t i = 0;
 
-      CStrUtil::skipSpace(line, &i1);
+  for ( ; i + 8 <= len; i += 8) {
+    uint64_t w;
 
-      i = i1;
+    memcpy(&w, data + i, 8);
 
-      if (i >= len)
-        break;
-    }
+    hash  = (hash ^ w)*prime;
+    hash ^= hash >> 29;
+  }
+
+  if (i < len) {
+    uint64_t w = 0;
 
-    line1 += line[i++];
+    memcpy(&w, data + i, len - i);
+
+    hash = (hash ^ w)*prime;
   }
 
-  return line1;
+  hash ^= hash >> 32;
+
+  return hash;
 }
 
+// add included file to dependencies of current input file (once)
 void
 CPrePro::
-add_file(const std::string &fileName)
+add_dependency(const std::string &fileName, bool std)
 {
-  files_.push_back(fileName);
+  if (std && deps_no_std_)
+    return;
+
+  if (deps_set_.insert(fileName).second)
+    deps_files_.push_back(fileName);
 }
 
+// add make rule for input file (target is -MT value(s) or file with .o suffix)
+// to dependency rules
 void
 CPrePro::
-add_define(const std::string &name, const VariableList &variables, const std::string &value)
+add_dependency_rule(const std::string &fileName)
 {
-  if (debug_) {
-    if (! variables.empty()) {
-      std::cerr << "Add Define " << name << "(";
-
-      int num_variables = int(variables.size());
+  if (! is_deps())
+    return;
 
-      for (int i = 0; i < num_variables; i++) {
-        if (i > 0)
-          std::cerr << ", ";
+  // escape make special characters
+  auto escape = [](const std::string &str) {
+    std::string str1;
 
-        std::cerr << variables[i];
-      }
+    for (const auto &c : str) {
+      if      (c == ' ' || c == '\t' || c == '#')
+        str1 += '\\';
+      else if (c == '$')
+        str1 += '$';
 
-      std::cerr << ")=" << value << "\n";
+      str1 += c;
     }
-    else
-      std::cerr << "Add Define " << name << "=" << value << "\n";
-  }
 
-  Define *define = get_define(name);
+    return str1;
+  };
 
-  if (! define) {
-    define = new Define(name, variables, value);
+  std::string rule;
 
-    defines_.push_back(define);
+  if (deps_targets_.empty()) {
+    std::string target = (fileName != "" ? fileName : "-");
 
-    return;
+    std::string::size_type p = target.rfind('/');
+
+    if (p != std::string::npos)
+      target = target.substr(p + 1);
+
+    p = target.rfind('.');
+
+    if (p != std::string::npos)
+      target = target.substr(0, p);
+
+    rule = escape(target + ".o");
   }
+  else {
+    for (const auto &target : deps_targets_) {
+      if (rule != "")
+        rule += " ";
 
-  bool redefined = false;
+      rule += target;
+    }
+  }
 
-  if (define->value != value)
-    redefined = true;
+  rule += ":";
 
-  if (define->variables.size() != variables.size())
-    redefined = true;
+  // wrap long lines with continuation
+  int line_len = int(rule.size());
 
-  if (! redefined && ! define->variables.empty()) {
-    int num_variables = int(define->variables.size());
+  auto addFile = [&](const std::string &file) {
+    std::string file1 = escape(file);
 
-    for (int i = 0; i < num_variables; i++) {
-      if (define->variables[i] != variables[i]) {
-        redefined = true;
-        break;
-      }
+    if (line_len + int(file1.size()) + 1 > 78) {
+      rule += " \\\n";
+
+      line_len = 0;
     }
+
+    rule += " " + file1;
+
+    line_len += int(file1.size()) + 1;
+  };
+
+  if (fileName != "")
+    addFile(fileName);
+
+  for (const auto &file : deps_files_)
+    addFile(file);
+
+  rule += "\n";
+
+  if (deps_phony_) {
+    for (const auto &file : deps_files_)
+      rule += escape(file) + ":\n";
   }
 
-  if (redefined)
-    std::cerr << "Redefinition of " << name << " from " << define->value << " to " << value <<
-                 " - " << current_file_ << ":" << current_line_ << "\n";
+  deps_rules_ += rule;
 
-  define->variables = variables;
-  define->value     = value;
+  deps_files_.clear();
+  deps_set_  .clear();
 }
 
+// write dependency rules to -MF file, file named from output (or first input) file
+// for -MD or to output for -M
 void
 CPrePro::
-remove_define(const std::string &name)
+write_dependencies()
 {
-  Define *define = get_define(name);
+  std::string fileName = deps_output_file_;
 
-  if (! define)
+  if (fileName == "" && deps_file_) {
+    fileName = output_file_;
+
+    if (fileName == "") {
+      fileName = (! files_.empty() && files_[0] != "" ? files_[0] : "stdin");
+
+      std::string::size_type p = fileName.rfind('/');
+
+      if (p != std::string::npos)
+        fileName = fileName.substr(p + 1);
+    }
+
+    std::string::size_type p  = fileName.rfind('.');
+    std::string::size_type p1 = fileName.rfind('/');
+
+    if (p != std::string::npos && (p1 == std::string::npos || p > p1))
+      fileName = fileName.substr(0, p);
+
+    fileName += ".d";
+  }
+
+  if (fileName == "") {
+    output_.write(deps_rules_.c_str(), deps_rules_.size());
     return;
+  }
 
-  defines_.remove(define);
+  std::ofstream os(fileName);
 
-  delete define;
+  if (! os) {
+    error("Failed to open dependency file '" + fileName + "'");
+    return;
+  }
+
+  os << deps_rules_;
 }
 
-CPrePro::Define *
+// start timing phase (time of current phase is stopped until end_phase)
+void
 CPrePro::
-get_define(const std::string &name)
+start_phase(Phase phase)
 {
-  for (const auto &pd : defines_)
-    if (pd->name == name)
-      return pd;
+  TimePoint t = Clock::now();
+
+  if (! phase_stack_.empty())
+    stats_data_.phases[int(phase_stack_.back())].time +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(t - phase_start_).count();
+
+  phase_stack_.push_back(phase);
 
-  return nullptr;
+  ++stats_data_.phases[int(phase)].count;
+
+  phase_start_ = t;
 }
 
 void
 CPrePro::
-add_include_dir(const std::string &dirName, bool std)
+end_phase()
 {
-  if (std)
-    std_include_dirs_.push_back(dirName);
-  else
-    include_dirs_.push_back(dirName);
-}
+  TimePoint t = Clock::now();
 
-std::string
-CPrePro::
-get_include_file(const std::string &fileName, bool &std)
-{
-  std = false;
+  stats_data_.phases[int(phase_stack_.back())].time +=
+    std::chrono::duration_cast<std::chrono::nanoseconds>(t - phase_start_).count();
 
-  if (CFile::exists(fileName))
-    return fileName;
+  phase_stack_.pop_back();
 
-  for (const auto &dir : include_dirs_) {
-    std::string fileName1 = dir + "/" + fileName;
+  phase_start_ = t;
+}
 
-    if (CFile::exists(fileName1))
-      return fileName1;
-  }
+// stats including object pool allocation counts
+CPrePro::Stats
+CPrePro::
+get_stats() const
+{
+  Stats stats = stats_data_;
 
-  std = true;
+  stats.objects_allocated += define_pool_ .numCreated() + context_pool_.numCreated() +
+                             include_pool_.numCreated();
+  stats.objects_reused    += define_pool_ .numReused () + context_pool_.numReused () +
+                             include_pool_.numReused ();
+  stats.pool_blocks       += define_pool_ .numBlocks () + context_pool_.numBlocks () +
+                             include_pool_.numBlocks ();
 
-  for (const auto &dir : std_include_dirs_) {
-    std::string fileName1 = dir + "/" + fileName;
+  return stats;
+}
 
-    if (CFile::exists(fileName1))
-      return fileName1;
-  }
+static const char *phase_names[] = {
+  "read", "scan", "trigraphs", "comments", "tokenize", "commands",
+  "expand", "expression", "include", "output"
+};
 
-  std::string fileName1 = "/usr/include/" + fileName;
+static long peakRSS()
+{
+  struct rusage usage;
 
-  if (CFile::exists(fileName1))
-    return fileName1;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
 
-  return "";
+  return usage.ru_maxrss; // KB
 }
 
 void
 CPrePro::
-start_context(bool processing)
+print_stats(std::ostream &os) const
 {
-  Context *old_context = context_;
+  if (stats_json_) {
+    print_stats_json(os);
+    return;
+  }
 
-  if (old_context)
-    context_stack_.push_back(old_context);
+  Stats stats = get_stats();
 
-  context_ = new Context;
+  auto ms = [](long t) { return double(t)/1000000.0; };
 
-  if (old_context)
-    context_->active = old_context->processing;
-  else
-    context_->active = true;
+  long total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      Clock::now() - start_time_).count();
 
-  context_->processing = processing;
-  context_->processed  = processing;
-}
+  char buffer[256];
 
-bool
-CPrePro::
-end_context()
-{
-  bool flag = true;
+  os << "Phase            :    Count    Time (ms)\n";
 
-  delete context_;
+  for (int i = 0; i < int(Phase::NUM_PHASES); ++i) {
+    const PhaseStats &phase = stats.phases[i];
 
-  if (! context_stack_.empty()) {
-    context_ = context_stack_.back();
+    snprintf(buffer, sizeof(buffer), "  %-14s : %8ld %12.3f\n",
+             phase_names[i], phase.count, ms(phase.time));
 
-    context_stack_.pop_back();
+    os << buffer;
   }
-  else
-    flag = false;
 
-  if (! context_) {
-    context_ = new Context;
+  snprintf(buffer, sizeof(buffer), "Total Time (ms)  : %.3f\n", ms(total_time));
 
-    context_->active     = true;
-    context_->processed  = false;
-    context_->processing = true;
-  }
+  os << buffer;
 
-  return flag;
-}
+  os << "Files Read       : " << stats.files_read << "\n";
+  os << "Bytes In/Out     : " << stats.bytes_in << " / " << stats.bytes_out << "\n";
+  os << "Defines          : " << stats.defines_added << " added, " <<
+                                 stats.defines_expanded << " expanded, " <<
+                                 stats.max_expand_depth << " max depth\n";
 
-CExprValuePtr
-CPrePro::
-defined_proc(const CExprValuePtr *values, int)
-{
-  CExprValuePtr value;
+  os << "Include Cache    : " << stats.include_cache_hits << " hits, " <<
+                                 stats.include_cache_misses << " misses\n";
 
-  long integer;
+  if (dir_cache_)
+    os << "Directory Cache  : " << stats.dir_cache_reads << " directories read, " <<
+                                   stats.dir_cache_hits << " hits, " <<
+                                   stats.dir_cache_misses << " misses\n";
 
-  if (values[0] && values[0]->getIntegerValue(integer))
-    value = expr_->createIntegerValue(integer);
-  else
-    value = expr_->createIntegerValue(0);
+  if (cache_dir_ != "")
+    os << "Result Cache     : " << stats.result_cache_hits << " hits, " <<
+                                   stats.result_cache_misses << " misses, " <<
+                                   stats.result_cache_evicted << " evicted\n";
 
-  return value;
+  os << "Includes Skipped : " << stats.includes_skipped << "\n";
+  os << "Lines Skipped    : " << stats.lines_skipped << "\n";
+  os << "Allocations      : " << stats.objects_allocated << " objects (" <<
+                                 stats.objects_reused << " reused) in " <<
+                                 stats.pool_blocks << " blocks\n";
+  os << "Peak RSS (KB)    : " << peakRSS() << "\n";
 }
 
 void
 CPrePro::
-terminate()
+print_stats_json(std::ostream &os) const
 {
-  if (list_includes_) {
-    if (current_include_)
-      current_include_->print(std::cout);
+  Stats stats = get_stats();
+
+  long total_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      Clock::now() - start_time_).count();
+
+  os << "{\n";
+  os << "  \"phases\": {\n";
+
+  for (int i = 0; i < int(Phase::NUM_PHASES); ++i) {
+    const PhaseStats &phase = stats.phases[i];
+
+    os << "    \"" << phase_names[i] << "\": { \"count\": " << phase.count <<
+          ", \"time_ns\": " << phase.time << " }" <<
+          (i < int(Phase::NUM_PHASES) - 1 ? "," : "") << "\n";
   }
+
+  os << "  },\n";
+  os << "  \"total_time_ns\": "        << total_time                 << ",\n";
+  os << "  \"files_read\": "           << stats.files_read           << ",\n";
+  os << "  \"bytes_in\": "             << stats.bytes_in             << ",\n";
+  os << "  \"bytes_out\": "            << stats.bytes_out            << ",\n";
+  os << "  \"defines_added\": "        << stats.defines_added        << ",\n";
+  os << "  \"defines_expanded\": "     << stats.defines_expanded     << ",\n";
+  os << "  \"max_expand_depth\": "     << stats.max_expand_depth     << ",\n";
+  os << "  \"include_cache_hits\": "   << stats.include_cache_hits   << ",\n";
+  os << "  \"include_cache_misses\": " << stats.include_cache_misses << ",\n";
+  os << "  \"dir_cache_reads\": "      << stats.dir_cache_reads      << ",\n";
+  os << "  \"dir_cache_hits\": "       << stats.dir_cache_hits       << ",\n";
+  os << "  \"dir_cache_misses\": "     << stats.dir_cache_misses     << ",\n";
+  os << "  \"result_cache_hits\": "    << stats.result_cache_hits    << ",\n";
+  os << "  \"result_cache_misses\": "  << stats.result_cache_misses  << ",\n";
+  os << "  \"result_cache_evicted\": " << stats.result_cache_evicted << ",\n";
+  os << "  \"includes_skipped\": "     << stats.includes_skipped     << ",\n";
+  os << "  \"lines_skipped\": "        << stats.lines_skipped        << ",\n";
+  os << "  \"objects_allocated\": "    << stats.objects_allocated    << ",\n";
+  os << "  \"objects_reused\": "       << stats.objects_reused       << ",\n";
+  os << "  \"pool_blocks\": "          << stats.pool_blocks          << ",\n";
+  os << "  \"peak_rss_kb\": "          << peakRSS()                  << "\n";
+  os << "}\n";
 }
@@ -0,0 +1,531 @@
+#include <CPreProExpr.h>
+
+CPreProExpr::
+CPreProExpr(CPrePro *prepro, const Tokens &tokens) :
+ prepro_(prepro), tokens_(tokens)
+{
+}
+
+// evaluate expression, errors are reported to the preprocessor
+bool
+CPreProExpr::
+evaluate(Value &value)
+{
+  pos_   = 0;
+  error_ = nullptr;
+  token_ = nullptr;
+
+  if (! peek())
+    setError("Missing expression");
+  else {
+    value = parseExpression(true);
+
+    if (! error_ && peek())
+      setError("Missing operator before", peek());
+  }
+
+  if (error_) {
+    std::string msg = error_;
+
+    if (token_)
+      msg += " '" + std::string(token_->str) + "'";
+
+    prepro_->error(msg + " in expression");
+
+    return false;
+  }
+
+  return true;
+}
+
+// <conditional> [, <conditional> ...]
+CPreProExpr::Value
+CPreProExpr::
+parseExpression(bool eval)
+{
+  Value value = parseConditional(eval);
+
+  while (! error_ && nextPunct(","))
+    value = parseConditional(eval);
+
+  return value;
+}
+
+// <binary> [? <expression> : <conditional>]
+CPreProExpr::Value
+CPreProExpr::
+parseConditional(bool eval)
+{
+  Value value = parseBinary(1, eval);
+
+  if (error_ || ! nextPunct("?"))
+    return value;
+
+  bool flag = (value.i != 0);
+
+  Value value1 = parseExpression(eval && flag);
+
+  if (error_)
+    return value1;
+
+  if (! nextPunct(":")) {
+    setError("Missing ':'", peek());
+    return value1;
+  }
+
+  Value value2 = parseConditional(eval && ! flag);
+
+  Value value3 = (flag ? value1 : value2);
+
+  value3.is_unsigned = (value1.is_unsigned || value2.is_unsigned);
+
+  return value3;
+}
+
+// binary operators with precedence >= prec (precedence climbing)
+CPreProExpr::Value
+CPreProExpr::
+parseBinary(int prec, bool eval)
+{
+  Value lhs = parseUnary(eval);
+
+  while (! error_) {
+    const Token *token = peek();
+
+    int prec1 = (token ? binaryPrecedence(*token) : 0);
+
+    if (prec1 < prec)
+      break;
+
+    next();
+
+    std::string_view op = token->str;
+
+    if      (op == "&&") {
+      bool flag = (lhs.i != 0);
+
+      Value rhs = parseBinary(prec1 + 1, eval && flag);
+
+      lhs = Value(flag && rhs.i != 0);
+    }
+    else if (op == "||") {
+      bool flag = (lhs.i != 0);
+
+      Value rhs = parseBinary(prec1 + 1, eval && ! flag);
+
+      lhs = Value(flag || rhs.i != 0);
+    }
+    else {
+      Value rhs = parseBinary(prec1 + 1, eval);
+
+      if (error_)
+        break;
+
+      lhs = applyBinary(op, lhs, rhs, eval);
+    }
+  }
+
+  return lhs;
+}
+
+CPreProExpr::Value
+CPreProExpr::
+parseUnary(bool eval)
+{
+  const Token *token = peek();
+
+  if (token && token->type == CPrePro::TokenType::PUNCT) {
+    std::string_view op = token->str;
+
+    if (op == "+" || op == "-" || op == "~" || op == "!") {
+      next();
+
+      Value value = parseUnary(eval);
+
+      if      (op == "-")
+        value.i = intmax_t(-value.u());
+      else if (op == "~")
+        value.i = intmax_t(~value.u());
+      else if (op == "!")
+        value = Value(value.i == 0);
+
+      return value;
+    }
+  }
+
+  return parsePrimary(eval);
+}
+
+// number, character constant, identifier (not a define so zero) or
+// bracketed expression
+CPreProExpr::Value
+CPreProExpr::
+parsePrimary(bool eval)
+{
+  const Token *token = next();
+
+  if (! token) {
+    setError("Missing value");
+    return Value();
+  }
+
+  switch (token->type) {
+    case CPrePro::TokenType::NUMBER:
+      return parseNumber(*token);
+
+    case CPrePro::TokenType::CHAR:
+      return parseChar(*token, false);
+
+    case CPrePro::TokenType::IDENTIFIER: {
+      // wide character constant (L'x', u'x', U'x', u8'x')
+      if (pos_ < int(tokens_.size()) && tokens_[pos_].type == CPrePro::TokenType::CHAR &&
+          (token->str == "L" || token->str == "u" || token->str == "U" || token->str == "u8"))
+        return parseChar(tokens_[pos_++], token->str != "u8");
+
+      return Value();
+    }
+
+    case CPrePro::TokenType::PUNCT: {
+      if (token->str == "(") {
+        Value value = parseExpression(eval);
+
+        if (! error_ && ! nextPunct(")"))
+          setError("Missing ')'", peek());
+
+        return value;
+      }
+
+      break;
+    }
+
+    default:
+      break;
+  }
+
+  setError("Invalid token", token);
+
+  return Value();
+}
+
+// integer constant (decimal, octal, hex or binary with u/l suffixes). Value is
+// unsigned if it has a 'u' suffix or is too large for intmax_t.
+CPreProExpr::Value
+CPreProExpr::
+parseNumber(const Token &token)
+{
+  std::string_view str = token.str;
+
+  int len = int(str.size());
+  int pos = 0;
+
+  int base = 10;
+
+  if      (len > 1 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+    base = 16; pos = 2;
+  }
+  else if (len > 1 && str[0] == '0' && (str[1] == 'b' || str[1] == 'B')) {
+    base = 2; pos = 2;
+  }
+  else if (str[0] == '0')
+    base = 8;
+
+  int       start    = pos;
+  uintmax_t u        = 0;
+  bool      overflow = false;
+
+  for ( ; pos < len; ++pos) {
+    char c = str[pos];
+
+    int d;
+
+    if      (c >= '0' && c <= '9') d = c - '0';
+    else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') d = c - 'A' + 10;
+    else                           break;
+
+    if (d >= base)
+      break;
+
+    if (u > (UINTMAX_MAX - uintmax_t(d))/uintmax_t(base))
+      overflow = true;
+
+    u = u*uintmax_t(base) + uintmax_t(d);
+  }
+
+  bool is_unsigned = false;
+  int  num_l       = 0;
+
+  for ( ; pos < len; ++pos) {
+    char c = str[pos];
+
+    if      ((c == 'u' || c == 'U') && ! is_unsigned)
+      is_unsigned = true;
+    else if ((c == 'l' || c == 'L') && num_l < 2)
+      ++num_l;
+    else
+      break;
+  }
+
+  if (pos < len || pos == start) {
+    setError("Invalid number", &token);
+    return Value();
+  }
+
+  if (overflow) {
+    setError("Number too large", &token);
+    return Value();
+  }
+
+  if (u > uintmax_t(INTMAX_MAX))
+    is_unsigned = true;
+
+  return Value(intmax_t(u), is_unsigned);
+}
+
+// character constant value. Multi-character constants are combined into an int
+// and a single (narrow) char is sign extended.
+CPreProExpr::Value
+CPreProExpr::
+parseChar(const Token &token, bool wide)
+{
+  std::string_view str = token.str;
+
+  int len = int(str.size());
+
+  if (len > 1 && str[len - 1] == '\'')
+    --len;
+
+  auto isOctal = [](char c) { return c >= '0' && c <= '7'; };
+
+  auto hexValue = [](char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  };
+
+  intmax_t i   = 0;
+  int      num = 0;
+
+  for (int pos = 1; pos < len; ++num) {
+    intmax_t c = (unsigned char) str[pos++];
+
+    if (c == '\\' && pos < len) {
+      c = str[pos++];
+
+      switch (c) {
+        case 'a': c = '\a'; break;
+        case 'b': c = '\b'; break;
+        case 'e': c = 27  ; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'v': c = '\v'; break;
+        case 'x': {
+          c = 0;
+
+          while (pos < len && hexValue(str[pos]) >= 0)
+            c = c*16 + hexValue(str[pos++]);
+
+          break;
+        }
+        default: {
+          if (isOctal(char(c))) {
+            c -= '0';
+
+            for (int j = 0; j < 2 && pos < len && isOctal(str[pos]); ++j)
+              c = c*8 + (str[pos++] - '0');
+          }
+
+          break;
+        }
+      }
+    }
+
+    if (wide)
+      i = c;
+    else
+      i = (i << 8) | (c & 0xff);
+  }
+
+  if (num == 0) {
+    setError("Empty character constant", &token);
+    return Value();
+  }
+
+  if (! wide && num == 1)
+    i = (signed char) i;
+
+  return Value(i);
+}
+
+CPreProExpr::Value
+CPreProExpr::
+applyBinary(std::string_view op, const Value &lhs, const Value &rhs, bool eval)
+{
+  bool is_unsigned = (lhs.is_unsigned || rhs.is_unsigned);
+
+  uintmax_t u1 = lhs.u(), u2 = rhs.u();
+
+  switch (op[0]) {
+    case '*':
+      return Value(intmax_t(u1*u2), is_unsigned);
+    case '/':
+    case '%': {
+      if (u2 == 0) {
+        if (eval)
+          setError("Division by zero");
+
+        return Value(0, is_unsigned);
+      }
+
+      if (is_unsigned)
+        return Value(intmax_t(op[0] == '/' ? u1/u2 : u1%u2), true);
+
+      // avoid overflow of INTMAX_MIN/-1
+      if (rhs.i == -1)
+        return Value(op[0] == '/' ? intmax_t(-u1) : 0);
+
+      return Value(op[0] == '/' ? lhs.i/rhs.i : lhs.i%rhs.i);
+    }
+    case '+':
+      return Value(intmax_t(u1 + u2), is_unsigned);
+    case '-':
+      return Value(intmax_t(u1 - u2), is_unsigned);
+    case '<':
+      if (op == "<<") return shift(lhs, rhs, true);
+      if (op == "<=") return Value(is_unsigned ? u1 <= u2 : lhs.i <= rhs.i);
+      return Value(is_unsigned ? u1 < u2 : lhs.i < rhs.i);
+    case '>':
+      if (op == ">>") return shift(lhs, rhs, false);
+      if (op == ">=") return Value(is_unsigned ? u1 >= u2 : lhs.i >= rhs.i);
+      return Value(is_unsigned ? u1 > u2 : lhs.i > rhs.i);
+    case '=':
+      return Value(u1 == u2);
+    case '!':
+      return Value(u1 != u2);
+    case '&':
+      return Value(intmax_t(u1 & u2), is_unsigned);
+    case '^':
+      return Value(intmax_t(u1 ^ u2), is_unsigned);
+    case '|':
+      return Value(intmax_t(u1 | u2), is_unsigned);
+    default:
+      break;
+  }
+
+  return Value();
+}
+
+// shift (result has type of lhs, negative count shifts in other direction and
+// right shift of negative signed value is arithmetic)
+CPreProExpr::Value
+CPreProExpr::
+shift(const Value &lhs, const Value &rhs, bool left)
+{
+  const int nbits = int(sizeof(uintmax_t)*8);
+
+  uintmax_t n = rhs.u();
+
+  if (! rhs.is_unsigned && rhs.i < 0) {
+    left = ! left;
+    n    = -n;
+  }
+
+  if (left) {
+    if (n >= uintmax_t(nbits))
+      return Value(0, lhs.is_unsigned);
+
+    return Value(intmax_t(lhs.u() << n), lhs.is_unsigned);
+  }
+
+  if (lhs.is_unsigned)
+    return Value(n >= uintmax_t(nbits) ? 0 : intmax_t(lhs.u() >> n), true);
+
+  if (n >= uintmax_t(nbits))
+    return Value(lhs.i < 0 ? -1 : 0);
+
+  return Value(lhs.i >> n);
+}
+
+int
+CPreProExpr::
+binaryPrecedence(const Token &token)
+{
+  if (token.type != CPrePro::TokenType::PUNCT)
+    return 0;
+
+  std::string_view op = token.str;
+
+  if (op.size() == 1) {
+    switch (op[0]) {
+      case '*': case '/': case '%': return 10;
+      case '+': case '-':           return 9;
+      case '<': case '>':           return 7;
+      case '&':                     return 5;
+      case '^':                     return 4;
+      case '|':                     return 3;
+      default:                      return 0;
+    }
+  }
+
+  if (op == "<<" || op == ">>") return 8;
+  if (op == "<=" || op == ">=") return 7;
+  if (op == "==" || op == "!=") return 6;
+  if (op == "&&"              ) return 2;
+  if (op == "||"              ) return 1;
+
+  return 0;
+}
+
+// next non-space token (not consumed)
+const CPreProExpr::Token *
+CPreProExpr::
+peek()
+{
+  int len = int(tokens_.size());
+
+  while (pos_ < len && tokens_[pos_].isSpace())
+    ++pos_;
+
+  return (pos_ < len ? &tokens_[pos_] : nullptr);
+}
+
+const CPreProExpr::Token *
+CPreProExpr::
+next()
+{
+  const Token *token = peek();
+
+  if (token)
+    ++pos_;
+
+  return token;
+}
+
+bool
+CPreProExpr::
+nextPunct(const char *s)
+{
+  const Token *token = peek();
+
+  if (! token || ! token->isPunct(s))
+    return false;
+
+  ++pos_;
+
+  return true;
+}
+
+// keep first error
+void
+CPreProExpr::
+setError(const char *msg, const Token *token)
+{
+  if (error_)
+    return;
+
+  error_ = msg;
+  token_ = token;
+}
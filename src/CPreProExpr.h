@@ -0,0 +1,63 @@
+#ifndef CPreProExpr_H
+#define CPreProExpr_H
+
+#include <CPrePro.h>
+#include <cstdint>
+
+// integer constant expression evaluator for #if/#elif working directly on the
+// (define expanded) preprocessing tokens. Values are intmax_t or uintmax_t using
+// the C conversion rules. &&, || and ?: are short circuit so errors (division by
+// zero) are not reported for unevaluated operands.
+class CPreProExpr {
+ public:
+  struct Value {
+    intmax_t i           { 0 };
+    bool     is_unsigned { false };
+
+    Value() { }
+
+    Value(intmax_t i_, bool is_unsigned_=false) :
+     i(i_), is_unsigned(is_unsigned_) {
+    }
+
+    uintmax_t u() const { return uintmax_t(i); }
+  };
+
+  using Token  = CPrePro::Token;
+  using Tokens = CPrePro::Tokens;
+
+ public:
+  CPreProExpr(CPrePro *prepro, const Tokens &tokens);
+
+  bool evaluate(Value &value);
+
+ private:
+  Value parseExpression(bool eval);
+  Value parseConditional(bool eval);
+  Value parseBinary(int prec, bool eval);
+  Value parseUnary(bool eval);
+  Value parsePrimary(bool eval);
+
+  Value parseNumber(const Token &token);
+  Value parseChar(const Token &token, bool wide);
+
+  Value applyBinary(std::string_view op, const Value &lhs, const Value &rhs, bool eval);
+  Value shift(const Value &lhs, const Value &rhs, bool left);
+
+  static int binaryPrecedence(const Token &token);
+
+  const Token *peek();
+  const Token *next();
+  bool         nextPunct(const char *s);
+
+  void setError(const char *msg, const Token *token=nullptr);
+
+ private:
+  CPrePro*      prepro_ { nullptr };
+  const Tokens &tokens_;
+  int           pos_    { 0 };
+  const char*   error_  { nullptr };
+  const Token*  token_  { nullptr };
+};
+
+#endif
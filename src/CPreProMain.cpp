@@ -0,0 +1,17 @@
+#include <CPrePro.h>
+
+extern int
+main(int argc, char **argv)
+{
+  CPrePro prepro;
+
+  prepro.initialize();
+
+  prepro.process_args(argc, argv);
+
+  prepro.process_files();
+
+  prepro.terminate();
+
+  return 0;
+}
@@ -0,0 +1,178 @@
+#include <CPreProScan.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define CPRE_PRO_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+using FindProc = const char *(*)(const char *, const char *, char, char, char);
+
+const char *
+findScalar(const char *p, const char *p_end, char c1, char c2, char c3)
+{
+  for ( ; p < p_end; ++p) {
+    char c = *p;
+
+    if (c == c1 || c == c2 || c == c3)
+      return p;
+  }
+
+  return p_end;
+}
+
+#ifdef CPRE_PRO_SCAN_X86
+// 16 byte blocks then scalar tail (inlined so it is VEX encoded in the AVX2 code
+// and there is no SSE/AVX transition)
+inline __attribute__((always_inline))
+const char *
+find16(const char *p, const char *p_end, char c1, char c2, char c3)
+{
+  const __m128i v1 = _mm_set1_epi8(c1);
+  const __m128i v2 = _mm_set1_epi8(c2);
+  const __m128i v3 = _mm_set1_epi8(c3);
+
+  while (p_end - p >= 16) {
+    __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+
+    __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(d, v1), _mm_cmpeq_epi8(d, v2)),
+                             _mm_cmpeq_epi8(d, v3));
+
+    int mask = _mm_movemask_epi8(m);
+
+    if (mask)
+      return p + __builtin_ctz(unsigned(mask));
+
+    p += 16;
+  }
+
+  for ( ; p < p_end; ++p) {
+    char c = *p;
+
+    if (c == c1 || c == c2 || c == c3)
+      return p;
+  }
+
+  return p_end;
+}
+
+const char *
+findSSE2(const char *p, const char *p_end, char c1, char c2, char c3)
+{
+  return find16(p, p_end, c1, c2, c3);
+}
+
+__attribute__((target("avx2")))
+const char *
+findAVX2(const char *p, const char *p_end, char c1, char c2, char c3)
+{
+  const __m256i v1 = _mm256_set1_epi8(c1);
+  const __m256i v2 = _mm256_set1_epi8(c2);
+  const __m256i v3 = _mm256_set1_epi8(c3);
+
+  while (p_end - p >= 32) {
+    __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+
+    __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(d, v1),
+                                                _mm256_cmpeq_epi8(d, v2)),
+                                _mm256_cmpeq_epi8(d, v3));
+
+    unsigned mask = unsigned(_mm256_movemask_epi8(m));
+
+    if (mask)
+      return p + __builtin_ctz(mask);
+
+    p += 32;
+  }
+
+  return find16(p, p_end, c1, c2, c3);
+}
+#endif
+
+CPreProScan::Impl
+bestImpl()
+{
+#ifdef CPRE_PRO_SCAN_X86
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+    return CPreProScan::Impl::AVX2;
+
+  return CPreProScan::Impl::SSE2;
+#else
+  return CPreProScan::Impl::NONE;
+#endif
+}
+
+FindProc
+implProc(CPreProScan::Impl impl)
+{
+#ifdef CPRE_PRO_SCAN_X86
+  if (impl == CPreProScan::Impl::AVX2) return findAVX2;
+  if (impl == CPreProScan::Impl::SSE2) return findSSE2;
+#endif
+
+  return findScalar;
+}
+
+CPreProScan::Impl scanImpl = bestImpl();
+FindProc          findProc = implProc(scanImpl);
+
+}
+
+const char *
+CPreProScan::
+findChar(const char *p, const char *p_end, char c1, char c2, char c3)
+{
+  return findProc(p, p_end, c1, c2, c3);
+}
+
+const char *
+CPreProScan::
+skipLiteral(const char *p, const char *p_end, char quote)
+{
+  while (p < p_end) {
+    p = findProc(p, p_end, quote, '\\', quote);
+
+    if (p >= p_end)
+      break;
+
+    if (*p == quote)
+      return p + 1;
+
+    // skip escaped char
+    if (p_end - p < 2)
+      break;
+
+    p += 2;
+  }
+
+  return p_end;
+}
+
+bool
+CPreProScan::
+setImpl(const std::string &name)
+{
+  Impl impl;
+
+  if      (name == "none" || name == "scalar")
+    impl = Impl::NONE;
+  else if (name == "sse2")
+    impl = Impl::SSE2;
+  else if (name == "avx2")
+    impl = Impl::AVX2;
+  else
+    return false;
+
+  Impl best = bestImpl();
+
+  if (int(impl) > int(best))
+    impl = best;
+
+  scanImpl = impl;
+  findProc = implProc(scanImpl);
+
+  return true;
+}
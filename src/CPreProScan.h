@@ -0,0 +1,29 @@
+#ifndef CPreProScan_H
+#define CPreProScan_H
+
+#include <string>
+
+// bulk character scanning used to strip comments. Candidate characters are found
+// 32 (AVX2) or 16 (SSE2) bytes at a time with the implementation selected at
+// runtime from the cpu features. Other targets use a scalar loop.
+class CPreProScan {
+ public:
+  enum class Impl {
+    NONE,
+    SSE2,
+    AVX2
+  };
+
+ public:
+  // first of c1, c2 or c3 in [p, p_end) (p_end if none)
+  static const char *findChar(const char *p, const char *p_end, char c1, char c2, char c3);
+
+  // end of string or char literal (p is after the opening quote). Returns pointer
+  // after the closing quote or p_end if unterminated (literals end at end of line)
+  static const char *skipLiteral(const char *p, const char *p_end, char quote);
+
+  // select implementation (best supported if not available)
+  static bool setImpl(const std::string &name);
+};
+
+#endif
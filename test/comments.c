@@ -0,0 +1,21 @@
+char *s = "/* not a comment */"; int a; /* real */ int b;
+char c = '"'; /* x */ char d = '/'; char *e = "a\"/*b";
+char *f = "\\"; /* gone */ int g = 1 / 2;
+/* multi
+ line "with quote
+ */ int h; // tail "q
+int i = 'a' /* c */ + L'\'';
+#define S "/*" x
+S
+/**/ int j;/*/ still */ int k;
+#if 0
+char *z = "/*";
+#endif
+int after;
+#if 0
+don't /* x */
+#endif
+int after2;
+
+#define CAT(a,b) a/**/b
+CAT(p,q) int/**/x;
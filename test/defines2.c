@@ -10,3 +10,8 @@ FRED
 BILL ( A , B )
 
 BILL ( A ", " , B )
+
+#define EMPTY
+#define NONE(a)
+
+[EMPTY] [NONE(A)]
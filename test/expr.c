@@ -0,0 +1,85 @@
+#define ZERO 0
+#define ONE  1
+#define TWO  (ONE + ONE)
+#define FUNC(a, b) ((a) * (b))
+
+#if ONE + TWO * 3 == 7
+arith_ok
+#endif
+
+#if (ONE + TWO) * 3 != 9
+arith_bad
+#else
+brackets_ok
+#endif
+
+#if -1 < 0 && -1 > 0u
+unsigned_ok
+#endif
+
+#if 0xFFFFFFFFFFFFFFFF == -1 && 0x7fffffffffffffff > 0
+hex_ok
+#endif
+
+#if 1 << 62 > 0 && (1u << 63) > 0 && -8 >> 1 == -4 && 8u >> 2 == 2
+shift_ok
+#endif
+
+#if ZERO && 1 / ZERO
+short_circuit_bad
+#elif ONE || 1 / ZERO
+short_circuit_ok
+#endif
+
+#if ONE ? 2 : 1 / ZERO
+conditional_ok
+#endif
+
+#if (ZERO ? 1u : -1) > 0
+conditional_unsigned_ok
+#endif
+
+#if defined ONE && defined(TWO) && ! defined THREE && !defined(THREE)
+defined_ok
+#endif
+
+#if UNDEFINED == 0 && UNDEFINED + 1 == 1
+undefined_ok
+#endif
+
+#if FUNC(TWO, 3) == 6 && FUNC(FUNC(2, 2), 2) == 8
+func_ok
+#endif
+
+#if 'a' == 97 && '\n' == 10 && '\377' < 0 && '\x41' == 'A'
+char_ok
+#endif
+
+#if 010 == 8 && 0x10 == 16 && 10UL == 10 && 10ll == 10
+number_ok
+#endif
+
+#if ~0 == -1 && (5 & 3) == 1 && (5 | 3) == 7 && (5 ^ 3) == 6 && 7 % 3 == 1
+bits_ok
+#endif
+
+#if 1
+first
+#elif 0
+second_bad
+#elif 1
+third_bad
+#else
+else_bad
+#endif
+
+#if 0
+#elif ONE
+elif_ok
+#endif
+
+#ifdef __has_include
+#if __has_include("expr.c") && ! __has_include("no_such_file.h")
+has_include_ok
+#endif
+#endif
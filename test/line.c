@@ -0,0 +1,14 @@
+#define LINE 200
+#define FILE "line_file.c"
+
+int a;
+#line 100
+int b;
+#line LINE FILE
+int c;
+# 10 "other.c"
+int d;
+#line 99999999999
+int e;
+# 99999999999 "f.c"
+int f;
@@ -0,0 +1,8 @@
+#include "once.h"
+#include "once_guard.h"
+#include "once/once_sub.h"
+#include "./once.h"
+#include "./once_guard.h"
+#include "once/../once.h"
+
+int once_main;
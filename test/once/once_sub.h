@@ -0,0 +1,4 @@
+#include "../once.h"
+#include "../once_guard.h"
+
+int once_sub;
@@ -0,0 +1,6 @@
+#ifndef ONCE_GUARD_H
+#define ONCE_GUARD_H
+
+int once_guard;
+
+#endif
@@ -0,0 +1,8 @@
+#define CAT(a, b) a ## b
+#define CAT3(a, b, c) a ## b ## c
+#define STR(a) #a
+#define XSTR(a) STR(a)
+CAT(fo, o) CAT(1, 2) CAT(-, >) CAT(<, <=) CAT(+, +) CAT(L, "wide") CAT(u8, "utf8")
+CAT(, y) CAT(a, ) CAT3(x, , z) CAT3(1, 2, 3)
+CAT(CA, T)(p, q)
+XSTR(CAT(foo, bar))
@@ -0,0 +1,175 @@
+// library session test : process buffers from a saved baseline while headers are
+// replaced (rename) or rewritten, created after a failed include and the include tree is reset,
+// and compiled defines are restored from a state file
+//
+// Usage: test_library [dir]
+
+#include <CPrePro.h>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+
+static int num_failed = 0;
+
+static void
+writeFile(const std::string &fileName, const std::string &text)
+{
+  std::ofstream os(fileName);
+
+  os << text;
+}
+
+static long
+fileSize(const std::string &fileName)
+{
+  struct stat st;
+
+  if (stat(fileName.c_str(), &st) != 0)
+    return -1;
+
+  return long(st.st_size);
+}
+
+static void
+check(const std::string &name, bool ok)
+{
+  std::cout << (ok ? "PASS " : "FAIL ") << name << "\n";
+
+  if (! ok)
+    ++num_failed;
+}
+
+static bool
+contains(const std::string &str, const std::string &match)
+{
+  return (str.find(match) != std::string::npos);
+}
+
+int
+main(int argc, char **argv)
+{
+  std::string dir = (argc > 1 ? argv[1] : "/tmp");
+
+  std::string header  = dir + "/test_library_h.h";
+  std::string missing = dir + "/test_library_m.h";
+  std::string state   = dir + "/test_library.state";
+
+  remove(missing.c_str());
+
+  writeFile(header, "int h_v1;\n");
+
+  CPrePro prepro;
+
+  prepro.set_capture_diagnostics(true);
+
+  prepro.initialize();
+
+  prepro.add_define("BASE", CPrePro::VariableList(), "42");
+
+  prepro.save_baseline();
+
+  std::string result;
+
+  //---
+
+  // header replaced by rename between buffers
+  std::string buffer1 = "#include \"" + header + "\"\nint x = BASE;\n";
+
+  bool ok = prepro.process_buffer("buffer1", buffer1, result);
+
+  check("include", ok && contains(result, "h_v1") && contains(result, "42"));
+
+  writeFile(header + ".new", "int h_v2;\n");
+
+  rename((header + ".new").c_str(), header.c_str());
+
+  ok = prepro.process_buffer("buffer1", buffer1, result);
+
+  check("renamed header", ok && contains(result, "h_v2") && ! contains(result, "h_v1"));
+
+  // header rewritten in place between buffers
+  writeFile(header, "int h_v3_long;\n");
+
+  ok = prepro.process_buffer("buffer1", buffer1, result);
+
+  check("modified header", ok && contains(result, "h_v3_long") && ! contains(result, "h_v2"));
+
+  //---
+
+  // header created after failed include
+  std::string buffer2 = "#if __has_include(\"" + missing + "\")\n"
+                        "#include \"" + missing + "\"\n"
+                        "#else\n"
+                        "int m_none;\n"
+                        "#endif\n"
+                        "#include \"" + missing + "\"\n";
+
+  prepro.process_buffer("buffer2", buffer2, result);
+
+  check("missing header", contains(result, "m_none") && ! prepro.diagnostics().empty());
+
+  writeFile(missing, "int m_v1;\n");
+
+  prepro.process_buffer("buffer2", buffer2, result);
+
+  check("created header", contains(result, "m_v1") && ! contains(result, "m_none") &&
+                          prepro.diagnostics().empty());
+
+  //---
+
+  // buffer defines are not kept and include tree does not grow
+  prepro.process_buffer("buffer3", "#define BASE 7\n#include \"" + header + "\"\n", result);
+
+  prepro.save_state(state);
+
+  long size1 = fileSize(state);
+
+  for (int i = 0; i < 10; ++i)
+    prepro.process_buffer("buffer3", "#define BASE 7\n#include \"" + header + "\"\n", result);
+
+  prepro.save_state(state);
+
+  long size2 = fileSize(state);
+
+  check("include tree", size1 > 0 && size1 == size2);
+
+  prepro.process_buffer("buffer4", "int y = BASE;\n", result);
+
+  check("baseline define", contains(result, "42"));
+
+  //---
+
+  // compiled defines restored from state file
+  CPrePro prepro1;
+
+  prepro1.set_capture_diagnostics(true);
+
+  prepro1.initialize();
+
+  prepro1.add_define("SUM" , CPrePro::VariableList({"a", "b"}), "a + b * SCALE", true);
+  prepro1.add_define("STR" , CPrePro::VariableList({"a"}), "#a \"\" a ## _t", true);
+  prepro1.add_define("SCALE", CPrePro::VariableList(), "3");
+
+  prepro1.save_state(state);
+
+  CPrePro prepro2;
+
+  prepro2.set_capture_diagnostics(true);
+
+  prepro2.initialize();
+
+  ok = prepro2.load_state(state);
+
+  prepro2.save_baseline();
+
+  prepro2.process_buffer("buffer5", "int z = SUM(1, 2); STR(s)\n", result);
+
+  check("state defines", ok && contains(result, "1 + 2 * 3") && contains(result, "\"s\" \"\" s_t"));
+
+  remove(header .c_str());
+  remove(missing.c_str());
+  remove(state  .c_str());
+
+  return (num_failed > 0 ? 1 : 0);
+}